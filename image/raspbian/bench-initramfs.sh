@@ -0,0 +1,150 @@
+#!/bin/bash -e
+
+#
+# TNG Base Raspberry Pi CMX Image
+# Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# compares the initramfs compression options:
+#
+#   ./bench-initramfs.sh         archive size and decompression time on this
+#                                machine for the cpio from make-initramfs.sh
+#   ./bench-initramfs.sh arch    init and archive size of the 32-bit and the
+#                                64-bit build (INIT_ARCH=arm64)
+#   ./bench-initramfs.sh compare <builddir> <builddir>...
+#                                init and archive size of other variants, e.g.
+#                                build-initramfs and build-initramfs-musl for
+#                                the glibc and the musl build (INIT_LIBC=musl)
+#   ./bench-initramfs.sh device  unpack time of the running kernel and exec to
+#                                main time of init, run this on the device after
+#                                booting each variant built with
+#                                INITRAMFS_COMPRESSION=<compression>,
+#                                INIT_OPTIMIZE=<optimization> and
+#                                INIT_ARCH=<architecture>
+
+if [ "$1" = "device" ]; then
+	# the kernel logs these two lines around unpacking the initramfs
+	begin=$(dmesg | grep -m 1 "Trying to unpack rootfs image as initramfs" | sed -e 's/^\[ *\([0-9.]*\)\].*/\1/')
+	end=$(dmesg | grep -m 1 "Freeing initrd memory" | sed -e 's/^\[ *\([0-9.]*\)\].*/\1/')
+	run_init=$(dmesg | grep -m 1 "Run /init as init process" | sed -e 's/^\[ *\([0-9.]*\)\].*/\1/')
+	start=$(dmesg | grep -m 1 "initramfs: started" | sed -e 's/^\[ *\([0-9.]*\)\].*/\1/')
+
+	if [ -z "${begin}" ] || [ -z "${end}" ]; then
+		echo "error: unpack messages not found in kernel log"
+		exit 1
+	fi
+
+	# the firmware loads initramfs8.img for a 64-bit kernel
+	if [ "$(uname -m)" = "aarch64" ]; then
+		image=/boot/initramfs8.img
+	else
+		image=/boot/initramfs7.img
+	fi
+
+	echo "architecture:    $(uname -m)"
+	echo "initramfs size:  $(stat -c %s ${image}) bytes"
+	echo "unpack time:     $(echo "(${end} - ${begin}) * 1000" | bc) msec"
+
+	if [ -n "${start}" ]; then
+		echo "init started at: $(echo "${start} * 1000" | bc) msec after boot"
+	fi
+
+	# exec-to-main time of init, depends on binary size and libc startup
+	if [ -n "${run_init}" ] && [ -n "${start}" ]; then
+		echo "exec to main:    $(echo "(${start} - ${run_init}) * 1000" | bc) msec"
+	fi
+
+	# time to interface and carrier of the Ethernet driver loaded by init
+	dmesg | grep "initramfs: Ethernet interface" | sed -e 's/^\[ *[0-9.]*\] initramfs: //'
+
+	exit 0
+fi
+
+# prints init and archive size for each given build directory
+compare_sizes() {
+	printf "%-28s %12s %14s %14s\n" "build" "init" "cpio" "image"
+
+	for builddir in "$@"; do
+		if [ -f ${builddir}/initramfs8.img ]; then
+			image=initramfs8
+		else
+			image=initramfs7
+		fi
+
+		if [ ! -f ${builddir}/${image}.img ]; then
+			printf "%-28s %12s\n" ${builddir} "not built"
+			continue
+		fi
+
+		printf "%-28s %6s bytes %8s bytes %8s bytes\n" ${builddir} $(stat -c %s ${builddir}/build/init) \
+		  $(stat -c %s ${builddir}/${image}.cpio) $(stat -c %s ${builddir}/${image}.img)
+	done
+}
+
+if [ "$1" = "arch" ]; then
+	compare_sizes build-initramfs build-initramfs-arm64
+	exit 0
+fi
+
+if [ "$1" = "compare" ]; then
+	if [ $# -lt 3 ]; then
+		echo "error: compare needs at least two build directories"
+		exit 1
+	fi
+
+	shift
+	compare_sizes "$@"
+	exit 0
+fi
+
+cpio=build-initramfs/initramfs7.cpio
+iterations=10
+
+if [ ! -f ${cpio} ]; then
+	echo "error: ${cpio} is missing, run make-initramfs.sh first"
+	exit 1
+fi
+
+printf "%-12s %12s %16s\n" "compression" "size" "decompression"
+
+for compression in gzip lz4 zstd none; do
+	case ${compression} in
+	gzip) compress="gzip -9"; decompress="gzip -d";;
+	lz4) compress="lz4 -l -9"; decompress="lz4 -d";;
+	zstd) compress="zstd -19"; decompress="zstd -d";;
+	none) compress="cat"; decompress="cat";;
+	esac
+
+	if ! command -v ${compress%% *} > /dev/null; then
+		printf "%-12s %12s\n" ${compression} "not installed"
+		continue
+	fi
+
+	${compress} < ${cpio} > /tmp/initramfs-bench.img 2> /dev/null
+
+	start=$(date +%s%N)
+
+	for i in $(seq ${iterations}); do
+		${decompress} < /tmp/initramfs-bench.img > /dev/null
+	done
+
+	end=$(date +%s%N)
+
+	printf "%-12s %6s bytes %11s usec\n" ${compression} $(stat -c %s /tmp/initramfs-bench.img) $(((end - start) / iterations / 1000))
+done
+
+rm -f /tmp/initramfs-bench.img
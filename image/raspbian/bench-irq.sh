@@ -0,0 +1,109 @@
+#!/bin/bash -e
+
+#
+# TNG Base Raspberry Pi CMX Image
+# Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# brickd request latency and Ethernet throughput, run this on the device once
+# booted with the IRQ affinity profile (tng.irq.usb=<cpus> or
+# /etc/tng-base-irq) and once with tng.skip=irq:
+#
+#   ./bench-irq.sh <iperf3-server> [<requests>]
+#
+# the latency is measured as the time from an enumerate request to the first
+# enumerate callback, so at least one Brick has to be connected. the Ethernet
+# throughput is measured with iperf3 while the requests are running, so both
+# compete for the dwc_otg interrupt
+
+if [ -z "$1" ]; then
+	echo "usage: $0 <iperf3-server> [<requests>]"
+	exit 1
+fi
+
+server=$1
+requests=${2:-1000}
+
+if [ -f /run/tng-base/cpuset ]; then
+	echo "IRQ affinity profile: $(tr '\n' ' ' < /run/tng-base/cpuset)"
+else
+	echo "IRQ affinity profile: not active"
+fi
+
+iperf3 -c ${server} -t 20 -J > /tmp/bench-irq.json &
+iperf3_pid=$!
+
+sleep 2 # let iperf3 ramp up
+
+python3 - ${requests} <<'END'
+import socket
+import struct
+import sys
+import time
+
+requests = int(sys.argv[1])
+latencies = []
+
+sock = socket.create_connection(('localhost', 4223))
+sock.settimeout(1.0)
+
+for sequence in range(requests):
+    # uid 0, length 8, function id 254 (enumerate), sequence number 1..15
+    sock.sendall(struct.pack('<IBBBB', 0, 8, 254, ((sequence % 15) + 1) << 4, 0))
+    start = time.monotonic()
+    buffer = b''
+
+    try:
+        while True:
+            buffer += sock.recv(4096)
+
+            # skip to the first enumerate callback (function id 253)
+            while len(buffer) >= 8 and buffer[5] != 253:
+                buffer = buffer[max(buffer[4], 8):]
+
+            if len(buffer) >= 8:
+                latencies.append(time.monotonic() - start)
+                break
+    except socket.timeout:
+        print('error: no enumerate callback, is a Brick connected?')
+        sys.exit(1)
+
+    time.sleep(0.01)
+
+    # drop the remaining callbacks of this enumerate
+    sock.setblocking(False)
+
+    try:
+        while sock.recv(4096):
+            pass
+    except BlockingIOError:
+        pass
+
+    sock.settimeout(1.0)
+
+latencies.sort()
+
+print('brickd latency:  avg {0:.2f} msec, median {1:.2f} msec, p99 {2:.2f} msec, max {3:.2f} msec'
+      .format(sum(latencies) / len(latencies) * 1000, latencies[len(latencies) // 2] * 1000,
+              latencies[len(latencies) * 99 // 100] * 1000, latencies[-1] * 1000))
+END
+
+wait ${iperf3_pid}
+
+python3 -c "import json; print('ethernet:        {0:.1f} Mbit/s'.format(json.load(open('/tmp/bench-irq.json'))['end']['sum_received']['bits_per_second'] / 1e6))"
+
+rm -f /tmp/bench-irq.json
@@ -0,0 +1,65 @@
+#
+# TNG Base Raspberry Pi CMX Image
+# Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# sourced by the scripts that build init and its static libraries to select
+# the build variant. init and the libraries it links against have to be built
+# with the same variables:
+#
+#   INIT_ARCH      armhf (default) or arm64. arm64 needs an aarch64-linux-gnu
+#                  cross toolchain and results in initramfs8.img for the 64-bit
+#                  kernel
+#   INIT_LIBC      glibc (default) or musl. musl needs an arm-linux-musleabihf
+#                  (or aarch64-linux-musl) cross toolchain (e.g. from musl.cc)
+#                  with musl 1.2.5 or newer for statx
+#   INIT_OPTIMIZE  speed (default) or size. the size variant enables section
+#                  garbage collection and LTO across init.c and all static
+#                  libraries
+#
+# sets host to the cross toolchain prefix, suffix to the build directory suffix
+# of the variant and optflags and ldflags to the compiler and linker flags. the
+# suffix is empty for the default variant only, so the other variants never
+# replace its libraries or its initramfs
+
+arch=${INIT_ARCH:-armhf}
+libc=${INIT_LIBC:-glibc}
+optimize=${INIT_OPTIMIZE:-speed}
+
+case ${arch} in
+armhf) machine=arm; abi=eabihf; arch_suffix="";;
+arm64) machine=aarch64; abi=""; arch_suffix="-arm64";;
+*)
+	echo "error: unknown architecture ${arch}"
+	exit 1;;
+esac
+
+case ${libc} in
+glibc) host=${machine}-linux-gnu${abi}; suffix="${arch_suffix}";;
+musl) host=${machine}-linux-musl${abi}; suffix="${arch_suffix}-musl";;
+*)
+	echo "error: unknown libc ${libc}"
+	exit 1;;
+esac
+
+case ${optimize} in
+speed) optflags="-O2"; ldflags="";;
+size) optflags="-Os -ffunction-sections -fdata-sections -flto"; ldflags="-Wl,--gc-sections"; suffix="${suffix}-size";;
+*)
+	echo "error: unknown optimization ${optimize}"
+	exit 1;;
+esac
@@ -0,0 +1,268 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <zlib.h>
+
+#include "eeprom.h"
+
+static uint64_t milliseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int i2c_transfer(int fd, struct i2c_msg *msgs, int msg_count)
+{
+	struct i2c_rdwr_ioctl_data args;
+
+	args.msgs = msgs;
+	args.nmsgs = msg_count;
+
+	return ioctl(fd, I2C_RDWR, &args) < 0 ? -1 : 0;
+}
+
+int eeprom_read(int fd, uint16_t address, void *buffer, size_t length)
+{
+	uint8_t address_bytes[2];
+	struct i2c_msg msgs[2];
+	size_t chunk_length;
+
+	while (length > 0) {
+		chunk_length = length < EEPROM_READ_CHUNK_LENGTH ? length : EEPROM_READ_CHUNK_LENGTH;
+
+		// set 16 bit read address and read chunk with a repeated start condition
+		address_bytes[0] = address >> 8;
+		address_bytes[1] = address & 0xFF;
+
+		msgs[0].addr = EEPROM_ADDRESS;
+		msgs[0].flags = 0;
+		msgs[0].len = sizeof(address_bytes);
+		msgs[0].buf = address_bytes;
+
+		msgs[1].addr = EEPROM_ADDRESS;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].len = chunk_length;
+		msgs[1].buf = buffer;
+
+		if (i2c_transfer(fd, msgs, 2) < 0) {
+			return -1;
+		}
+
+		address += chunk_length;
+		buffer = (uint8_t *)buffer + chunk_length;
+		length -= chunk_length;
+	}
+
+	return 0;
+}
+
+int eeprom_write(int fd, uint16_t address, const void *buffer, size_t length)
+{
+	uint8_t page[2 + EEPROM_PAGE_LENGTH];
+	struct i2c_msg msg;
+	size_t chunk_length;
+	uint64_t timeout;
+
+	while (length > 0) {
+		// a page write must not cross a page boundary, otherwise it wraps around
+		chunk_length = EEPROM_PAGE_LENGTH - (address % EEPROM_PAGE_LENGTH);
+
+		if (chunk_length > length) {
+			chunk_length = length;
+		}
+
+		page[0] = address >> 8;
+		page[1] = address & 0xFF;
+
+		memcpy(page + 2, buffer, chunk_length);
+
+		msg.addr = EEPROM_ADDRESS;
+		msg.flags = 0;
+		msg.len = 2 + chunk_length;
+		msg.buf = page;
+
+		if (i2c_transfer(fd, &msg, 1) < 0) {
+			return -1;
+		}
+
+		// the EEPROM doesn't acknowledge its address during the internal write
+		// cycle. poll for the acknowledge instead of sleeping a fixed time
+		msg.len = 2;
+		timeout = milliseconds() + EEPROM_WRITE_TIMEOUT;
+
+		while (i2c_transfer(fd, &msg, 1) < 0) {
+			if (milliseconds() > timeout) {
+				errno = ETIMEDOUT;
+
+				return -1;
+			}
+
+			usleep(500);
+		}
+
+		address += chunk_length;
+		buffer = (const uint8_t *)buffer + chunk_length;
+		length -= chunk_length;
+	}
+
+	return 0;
+}
+
+bool eeprom_check_header(const EEPROM_Header *header, char *message, size_t message_length)
+{
+	if (header->magic_number != EEPROM_MAGIC_NUMBER) {
+		snprintf(message, message_length, "EEPROM header has wrong magic number: %08X (actual) != %08X (expected)",
+		         header->magic_number, EEPROM_MAGIC_NUMBER);
+
+		return false;
+	}
+
+	return true;
+}
+
+// an /etc/shadow password entry is written as is into the shadow line. it has
+// to be a crypt hash, or a lock marker (! or * prefix) written by eeprom.py for
+// locked accounts. an empty entry would leave the account without a password
+bool eeprom_check_encrypted_password(const char *encrypted_password, bool allow_lock)
+{
+	if (encrypted_password[0] != '$' && (!allow_lock || (encrypted_password[0] != '!' && encrypted_password[0] != '*'))) {
+		return false;
+	}
+
+	return strpbrk(encrypted_password, ":\n") == NULL;
+}
+
+bool eeprom_parse(const uint8_t *blob, size_t blob_length, EEPROM *eeprom, char *message, size_t message_length)
+{
+	union {
+		EEPROM eeprom;
+		uint8_t bytes[sizeof(EEPROM)];
+	} u;
+	uint32_t checksum;
+	int i;
+	const EEPROM_Account *account;
+
+	memset(&u, 0, sizeof(u));
+
+	if (blob_length < sizeof(u.eeprom.header)) {
+		snprintf(message, message_length, "EEPROM header is truncated: %zu (actual) < %zu (expected)",
+		         blob_length, sizeof(u.eeprom.header));
+
+		return false;
+	}
+
+	memcpy(&u.eeprom.header, blob, sizeof(u.eeprom.header));
+
+	if (!eeprom_check_header(&u.eeprom.header, message, message_length)) {
+		return false;
+	}
+
+	if (blob_length < sizeof(u.eeprom.header) + u.eeprom.header.data_length) {
+		snprintf(message, message_length, "EEPROM data is truncated: %zu (actual) < %zu (expected)",
+		         blob_length - sizeof(u.eeprom.header), (size_t)u.eeprom.header.data_length);
+
+		return false;
+	}
+
+	memcpy(u.bytes + sizeof(u.eeprom.header), blob + sizeof(u.eeprom.header),
+	       u.eeprom.header.data_length < sizeof(u.eeprom) - sizeof(u.eeprom.header) ?
+	       u.eeprom.header.data_length : sizeof(u.eeprom) - sizeof(u.eeprom.header));
+
+	// check header and data
+	checksum = crc32(0, Z_NULL, 0);
+	checksum = crc32(checksum, (uint8_t *)&u.eeprom.header.data_length, sizeof(u.eeprom.header.data_length));
+	checksum = crc32(checksum, (uint8_t *)&u.eeprom.header.data_version, sizeof(u.eeprom.header.data_version));
+	checksum = crc32(checksum, blob + sizeof(u.eeprom.header), u.eeprom.header.data_length);
+
+	if (u.eeprom.header.checksum != checksum) {
+		snprintf(message, message_length, "EEPROM header/data has wrong checksum: %08X (actual) != %08X (expected)",
+		         checksum, u.eeprom.header.checksum);
+
+		return false;
+	}
+
+	if (u.eeprom.header.data_version < 1) {
+		snprintf(message, message_length, "EEPROM header has invalid data-version: %u (actual) < 1 (expected)",
+		         u.eeprom.header.data_version);
+
+		return false;
+	}
+
+	if (u.eeprom.header.data_version == 1 && u.eeprom.header.data_length < sizeof(u.eeprom.data_v1)) {
+		snprintf(message, message_length, "EEPROM header has invalid data-length: %u (actual) < %zu (expected)",
+		         u.eeprom.header.data_length, sizeof(u.eeprom.data_v1));
+
+		return false;
+	}
+
+	if (u.eeprom.header.data_version >= 2 && u.eeprom.header.data_length < sizeof(u.eeprom.data_v1) + sizeof(u.eeprom.data_v2)) {
+		snprintf(message, message_length, "EEPROM header has invalid data-length: %u (actual) < %zu (expected)",
+		         u.eeprom.header.data_length, sizeof(u.eeprom.data_v1) + sizeof(u.eeprom.data_v2));
+
+		return false;
+	}
+
+	if (u.eeprom.data_v1.uid[sizeof(u.eeprom.data_v1.uid) - 1] != '\0') {
+		snprintf(message, message_length, "EEPROM data UID is not null-terminated");
+
+		return false;
+	}
+
+	if (u.eeprom.data_v1.hostname[sizeof(u.eeprom.data_v1.hostname) - 1] != '\0') {
+		snprintf(message, message_length, "EEPROM data hostname is not null-terminated");
+
+		return false;
+	}
+
+	if (u.eeprom.data_v1.encrypted_password[sizeof(u.eeprom.data_v1.encrypted_password) - 1] != '\0') {
+		snprintf(message, message_length, "EEPROM data encrypted-password is not null-terminated");
+
+		return false;
+	}
+
+	for (i = 0; u.eeprom.header.data_version >= 2 && i < EEPROM_ACCOUNT_COUNT; ++i) {
+		account = &u.eeprom.data_v2.accounts[i];
+
+		if (account->name[sizeof(account->name) - 1] != '\0' ||
+		    account->default_password[sizeof(account->default_password) - 1] != '\0' ||
+		    account->encrypted_password[sizeof(account->encrypted_password) - 1] != '\0') {
+			snprintf(message, message_length, "EEPROM data account %d is not null-terminated", i);
+
+			return false;
+		}
+	}
+
+	memcpy(eeprom, &u.eeprom, sizeof(*eeprom));
+
+	return true;
+}
@@ -0,0 +1,111 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+// TNG EEPROM layout and access functions, shared between init.c and the
+// tng-eeprom provisioning tool. all fields are stored as little endian.
+
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEPROM_PATH "/dev/i2c-1"
+#define EEPROM_ADDRESS 0x50
+#define EEPROM_MAGIC_NUMBER 0x21474E54
+#define EEPROM_PAGE_LENGTH 32 // M24C64 page write size
+#define EEPROM_READ_CHUNK_LENGTH 4096 // i2c-dev limits a single message to 8192 bytes
+#define EEPROM_WRITE_TIMEOUT 20 // msec, M24C64 write cycle is 5 msec max
+#define EEPROM_MAX_LENGTH (sizeof(EEPROM_Header) + UINT16_MAX)
+#define ETHERNET_CONFIG_LENGTH 256
+#define EEPROM_ACCOUNT_COUNT 4
+#define EEPROM_CACHE_DIRECTORY "/run/tng-base"
+#define EEPROM_CACHE_BLOB_PATH EEPROM_CACHE_DIRECTORY"/eeprom.bin" // validated raw EEPROM content, root only
+#define EEPROM_CACHE_RECORD_PATH EEPROM_CACHE_DIRECTORY"/eeprom.record" // EEPROM_Record, world readable
+#define EEPROM_RECORD_MAGIC_NUMBER 0x21524554 // TER!
+#define EEPROM_RECORD_VERSION 1
+
+typedef struct {
+	uint32_t magic_number; // magic number 0x21474E54 (TNG!)
+	uint32_t checksum; // zlib CRC32 checksum over all following bytes
+	uint16_t data_length; // length of data blocks in byte
+	uint8_t data_version; // indicating the available data blocks
+} __attribute__((packed)) EEPROM_Header;
+
+typedef struct {
+	uint32_t production_date; // BCD formatted production date (0x20200827 -> 2020-08-27), exposed at /etc/tng-base-production-date
+	char uid[7]; // null-terminated unique identifier, exposed at /etc/tng-base-uid
+	char hostname[65]; // null-terminated /etc/hostname entry, also exposed at /etc/tng-base-hostname
+	char encrypted_password[107]; // null-terminated /etc/shadow password entry
+	uint8_t ethernet_config[ETHERNET_CONFIG_LENGTH]; // config for Ethernet chip, MAC address exposed at /etc/tng-base-mac-address
+} __attribute__((packed)) EEPROM_DataV1;
+
+typedef struct {
+	char name[33]; // null-terminated account name, empty if the slot is unused
+	char default_password[33]; // null-terminated default password the account is expected to have
+	char encrypted_password[107]; // null-terminated /etc/shadow password entry replacing the default password
+} __attribute__((packed)) EEPROM_Account;
+
+typedef struct {
+	EEPROM_Account accounts[EEPROM_ACCOUNT_COUNT]; // additional accounts, the tng account is covered by data version 1
+} __attribute__((packed)) EEPROM_DataV2;
+
+typedef struct {
+	EEPROM_Header header;
+	EEPROM_DataV1 data_v1;
+	EEPROM_DataV2 data_v2; // only valid if data_version >= 2
+} __attribute__((packed)) EEPROM;
+
+// fixed-layout record of the validated EEPROM content written by init.c to
+// EEPROM_CACHE_RECORD_PATH, so userspace doesn't need to access the EEPROM.
+// the password fields are left out, because the record is world readable.
+// new fields are only ever appended and increase record_version
+typedef struct {
+	uint32_t magic_number; // magic number 0x21524554 (TER!)
+	uint16_t record_version;
+	uint16_t record_length; // sizeof(EEPROM_Record) of the writer
+	uint8_t data_version; // EEPROM data version
+	uint32_t production_date;
+	char uid[7];
+	char hostname[65];
+	uint8_t ethernet_config[ETHERNET_CONFIG_LENGTH];
+	char account_names[EEPROM_ACCOUNT_COUNT][33]; // empty if data version < 2 or the slot is unused
+} __attribute__((packed)) EEPROM_Record;
+
+// the layouts are shared with eeprom.py and between the 32-bit and the 64-bit
+// init, catch accidental padding or differently sized fields at compile time
+_Static_assert(sizeof(EEPROM_Header) == 11, "EEPROM_Header has wrong size");
+_Static_assert(sizeof(EEPROM_DataV1) == 439, "EEPROM_DataV1 has wrong size");
+_Static_assert(sizeof(EEPROM_DataV2) == 692, "EEPROM_DataV2 has wrong size");
+_Static_assert(sizeof(EEPROM_Record) == 473, "EEPROM_Record has wrong size");
+
+// bulk I2C access, return -1 and set errno on error
+int eeprom_read(int fd, uint16_t address, void *buffer, size_t length);
+int eeprom_write(int fd, uint16_t address, const void *buffer, size_t length);
+
+// validation, return false and fill message on error
+bool eeprom_check_header(const EEPROM_Header *header, char *message, size_t message_length);
+bool eeprom_parse(const uint8_t *blob, size_t blob_length, EEPROM *eeprom, char *message, size_t message_length);
+
+// check an encrypted-password entry before it is written into /etc/shadow,
+// allow_lock also accepts a ! or * lock marker
+bool eeprom_check_encrypted_password(const char *encrypted_password, bool allow_lock);
+
+#endif
@@ -29,8 +29,11 @@ import argparse
 import subprocess
 from datetime import datetime
 
+TNG_HEADER_LENGTH = 11
 TNG_CONFIG_LENGTH = 450
+TNG_CONFIG_V2_LENGTH = 1142
 ETH_CONFIG_LENGTH = 256
+ACCOUNT_COUNT = 4
 
 def print_hex(data):
     subprocess.run(['xxd', '-g', '1', '-'], input=data)
@@ -63,10 +66,39 @@ def bcd(decimal):
 # - char[7]      uid:                null-terminated unique identifier, exposed at /etc/tng-base-uid
 # - char[65]     hostname:           null-terminated /etc/hostname entry, also exposed at /etc/tng-base-hostname
 # - char[107]    encrypted_password: null-terminated /etc/shadow password entry
-# - uint8_t[256] ethernet_config:    config for Ethernet chip
+# - uint8_t[256] ethernet_config:    config for Ethernet chip, MAC address exposed at /etc/tng-base-mac-address
 #
+# data (version 2), 4 account slots, unused slots have an empty name:
+# - char[33]     name:               null-terminated account name
+# - char[33]     default_password:   null-terminated default password the account is expected to have
+# - char[107]    encrypted_password: null-terminated /etc/shadow password entry replacing the default password
+#
+
+def format_accounts(accounts):
+    assert len(accounts) <= ACCOUNT_COUNT, accounts
+
+    accounts_bytes = b''
+
+    for name, default_password, password in accounts + [('', '', None)] * (ACCOUNT_COUNT - len(accounts)):
+        # a password starting with ! or * is stored as is to lock the account
+        if password == None:
+            encrypted_password = ''
+        elif password.startswith('!') or password.startswith('*'):
+            encrypted_password = password
+        else:
+            encrypted_password = encrypt_password(password)
+
+        assert len(name) <= 32, name
+        assert len(default_password) <= 32, default_password
+        assert len(encrypted_password) <= 106, encrypted_password
 
-def format_tng_config(uid, hostname, password, mac_address):
+        accounts_bytes += struct.pack('<33s', name.encode('ascii'))
+        accounts_bytes += struct.pack('<33s', default_password.encode('ascii'))
+        accounts_bytes += struct.pack('<107s', encrypted_password.encode('ascii'))
+
+    return accounts_bytes
+
+def format_tng_config(uid, hostname, password, mac_address, accounts=[]):
     encrypted_password = encrypt_password(password)
 
     assert len(uid) <= 6, uid
@@ -82,9 +114,14 @@ def format_tng_config(uid, hostname, password, mac_address):
     ethernet_config_bytes = format_eth_config(mac_address)
 
     data_bytes = production_date_bytes + uid_bytes + hostname_bytes + encrypted_password_bytes + ethernet_config_bytes
+    data_version = 1
+
+    if len(accounts) > 0:
+        data_bytes += format_accounts(accounts)
+        data_version = 2
 
     data_length_bytes = struct.pack('<H', len(data_bytes))
-    data_version_bytes = struct.pack('<B', 1)
+    data_version_bytes = struct.pack('<B', data_version)
 
     checksum = binascii.crc32(data_length_bytes + data_version_bytes + data_bytes) & 0xFFFFFFFF
     checksum_bytes = struct.pack('<I', checksum)
@@ -92,7 +129,7 @@ def format_tng_config(uid, hostname, password, mac_address):
     magic_number_bytes = struct.pack('<I', 0x21474E54)
     config_bytes = magic_number_bytes + checksum_bytes + data_length_bytes + data_version_bytes + data_bytes
 
-    assert len(config_bytes) == TNG_CONFIG_LENGTH, len(config_bytes)
+    assert len(config_bytes) == (TNG_CONFIG_LENGTH if data_version == 1 else TNG_CONFIG_V2_LENGTH), len(config_bytes)
 
     return config_bytes
 
@@ -658,8 +695,11 @@ def write_eth_eeprom(device, data):
 def main():
     parser = argparse.ArgumentParser()
 
-    parser.add_argument('action', choices=['tng-print', 'tng-read', 'tng-write', 'eth-print', 'eth-read', 'eth-write', 'eth-clear'])
+    parser.add_argument('action', choices=['tng-print', 'tng-save', 'tng-read', 'tng-write', 'eth-print', 'eth-read', 'eth-write', 'eth-clear'])
     parser.add_argument('--eth-device')
+    parser.add_argument('--output')
+    parser.add_argument('--account', action='append', default=[], metavar='NAME:DEFAULT-PASSWORD:PASSWORD',
+                        help='additional account for data version 2, a PASSWORD starting with ! or * locks the account')
 
     args = parser.parse_args()
 
@@ -667,17 +707,27 @@ def main():
     hostname = 'tng-base-' + uid
     password = 'foobar' # FIXME
     mac_address = [0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC] # FIXME
+    accounts = [tuple(account.split(':', 2)) for account in args.account]
 
     if args.action == 'tng-print':
-        config_bytes = format_tng_config(uid, hostname, password, mac_address)
+        config_bytes = format_tng_config(uid, hostname, password, mac_address, accounts)
 
         print_hex(config_bytes)
+    elif args.action == 'tng-save':
+        # binary EEPROM image for tng-eeprom write/verify
+        config_bytes = format_tng_config(uid, hostname, password, mac_address, accounts)
+
+        with open(args.output, 'wb') as f:
+            f.write(config_bytes)
     elif args.action == 'tng-read':
-        config_bytes = read_tng_eeprom(TNG_CONFIG_LENGTH)
+        # read the header first, the data length depends on the data version
+        header_bytes = read_tng_eeprom(TNG_HEADER_LENGTH)
+        data_length = struct.unpack_from('<H', header_bytes, 8)[0]
+        config_bytes = read_tng_eeprom(TNG_HEADER_LENGTH + data_length)
 
         print_hex(config_bytes)
     elif args.action == 'tng-write':
-        config_bytes = format_tng_config(uid, hostname, password, mac_address)
+        config_bytes = format_tng_config(uid, hostname, password, mac_address, accounts)
 
         write_tng_eeprom(config_bytes)
 
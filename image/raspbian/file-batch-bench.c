@@ -0,0 +1,249 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+// compares the io_uring and the synchronous backend of file-batch.c. run it
+// as root on the device against a directory on the SD card backed root, so
+// that the page cache can be dropped before each iteration:
+//
+//   file-batch-bench /var/tmp/file-batch-bench 16 20
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "file-batch.h"
+
+#define MAX_FILE_COUNT 32 // reads are submitted in chunks of FILE_BATCH_RING_LENGTH / 2
+
+static char paths[MAX_FILE_COUNT][256];
+static char tmp_paths[MAX_FILE_COUNT][256];
+static char buffers[MAX_FILE_COUNT][64];
+
+static uint64_t microseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_file(const char *path)
+{
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0444);
+
+	if (fd < 0) {
+		fprintf(stderr, "error: could not create %s: %s (%d)\n", path, strerror(errno), errno);
+
+		return -1;
+	}
+
+	if (write(fd, "file-batch-bench\n", 17) != 17) {
+		fprintf(stderr, "error: could not write to %s\n", path);
+		close(fd);
+
+		return -1;
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+
+	if (fd < 0) {
+		return; // not root, measure with warm caches
+	}
+
+	if (write(fd, "3\n", 2) != 2) {
+		fprintf(stderr, "warning: could not drop caches\n");
+	}
+
+	close(fd);
+}
+
+static int run(bool uring, size_t file_count, int iterations)
+{
+	FileBatch batch;
+	FileOp ops[MAX_FILE_COUNT];
+	size_t i;
+	int k;
+	uint64_t start;
+	uint64_t read_total = 0;
+	uint64_t rename_total = 0;
+	uint64_t read_min = UINT64_MAX;
+	uint64_t rename_min = UINT64_MAX;
+	uint64_t elapsed;
+
+	if (file_batch_init(&batch, uring) != uring) {
+		fprintf(stderr, "error: io_uring is not available\n");
+
+		return -1;
+	}
+
+	for (k = 0; k < iterations; ++k) {
+		// reads
+		drop_caches();
+		memset(ops, 0, sizeof(ops));
+
+		for (i = 0; i < file_count; ++i) {
+			ops[i].type = FILE_OP_READ;
+			ops[i].path = paths[i];
+			ops[i].buffer = buffers[i];
+			ops[i].buffer_length = sizeof(buffers[i]);
+		}
+
+		start = microseconds();
+
+		file_batch_run(&batch, ops, file_count);
+
+		elapsed = microseconds() - start;
+		read_total += elapsed;
+		read_min = elapsed < read_min ? elapsed : read_min;
+
+		for (i = 0; i < file_count; ++i) {
+			if (ops[i].stat_result < 0 || ops[i].result != 17) {
+				fprintf(stderr, "error: could not read %s\n", paths[i]);
+				file_batch_free(&batch);
+
+				return -1;
+			}
+		}
+
+		// renames
+		for (i = 0; i < file_count; ++i) {
+			if (write_file(tmp_paths[i]) < 0) {
+				file_batch_free(&batch);
+
+				return -1;
+			}
+		}
+
+		drop_caches();
+		memset(ops, 0, sizeof(ops));
+
+		for (i = 0; i < file_count; ++i) {
+			ops[i].type = FILE_OP_RENAME;
+			ops[i].path = tmp_paths[i];
+			ops[i].new_path = paths[i];
+		}
+
+		start = microseconds();
+
+		file_batch_run(&batch, ops, file_count);
+
+		elapsed = microseconds() - start;
+		rename_total += elapsed;
+		rename_min = elapsed < rename_min ? elapsed : rename_min;
+
+		for (i = 0; i < file_count; ++i) {
+			if (ops[i].result < 0) {
+				fprintf(stderr, "error: could not rename %s: %s\n", tmp_paths[i], strerror(-ops[i].result));
+				file_batch_free(&batch);
+
+				return -1;
+			}
+		}
+	}
+
+	file_batch_free(&batch);
+
+	printf("%-12s read %zu files: avg %6llu usec, min %6llu usec | rename %zu files: avg %6llu usec, min %6llu usec\n",
+	       uring ? "io_uring" : "synchronous",
+	       file_count, (unsigned long long)(read_total / iterations), (unsigned long long)read_min,
+	       file_count, (unsigned long long)(rename_total / iterations), (unsigned long long)rename_min);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *directory;
+	size_t file_count = 16;
+	int iterations = 20;
+	size_t i;
+	int rc = EXIT_SUCCESS;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: %s <directory> [<file-count> [<iterations>]]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	directory = argv[1];
+
+	if (argc > 2) {
+		file_count = strtoul(argv[2], NULL, 10);
+	}
+
+	if (argc > 3) {
+		iterations = atoi(argv[3]);
+	}
+
+	if (file_count < 1 || file_count > MAX_FILE_COUNT || iterations < 1) {
+		fprintf(stderr, "error: file-count must be 1 to %d, iterations must be positive\n", MAX_FILE_COUNT);
+
+		return EXIT_FAILURE;
+	}
+
+	if (mkdir(directory, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "error: could not create %s: %s (%d)\n", directory, strerror(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < file_count; ++i) {
+		snprintf(paths[i], sizeof(paths[i]), "%s/file-%zu", directory, i);
+		snprintf(tmp_paths[i], sizeof(tmp_paths[i]), "%s/file-%zu.tmp", directory, i);
+
+		if (write_file(paths[i]) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (run(false, file_count, iterations) < 0) {
+		rc = EXIT_FAILURE;
+	}
+
+	if (run(true, file_count, iterations) < 0) {
+		rc = EXIT_FAILURE;
+	}
+
+	for (i = 0; i < file_count; ++i) {
+		unlink(paths[i]);
+	}
+
+	rmdir(directory);
+
+	return rc;
+}
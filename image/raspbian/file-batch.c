@@ -0,0 +1,639 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+
+#include "file-batch.h"
+
+#define STATX_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE)
+
+// result of an operation that didn't complete (yet), no errno is this negative
+#define RESULT_PENDING INT_MIN
+
+// stats and reads are independent of each other and run in the first pass,
+// renames and unlinks run in order in the second pass
+static bool is_lookup(const FileOp *op)
+{
+	return op->type == FILE_OP_READ || op->type == FILE_OP_STAT;
+}
+
+static void stat_sync(FileOp *op)
+{
+	op->stat_result = statx(AT_FDCWD, op->path, 0, STATX_MASK, &op->statx) < 0 ? -errno : 0;
+}
+
+// read no more than the file size reported by statx, so a read of an unchanged
+// file is never short. a short read would break the link to the close
+static size_t get_read_length(FileOp *op)
+{
+	if (op->stat_result == 0 && op->statx.stx_size < op->buffer_length) {
+		return op->statx.stx_size;
+	}
+
+	return op->buffer_length;
+}
+
+static void read_fd_sync(FileOp *op)
+{
+	ssize_t length = read(op->fd, op->buffer, get_read_length(op));
+
+	op->result = length < 0 ? -errno : length;
+}
+
+static void read_sync(FileOp *op)
+{
+	op->fd = open(op->path, O_RDONLY | O_CLOEXEC);
+
+	if (op->fd < 0) {
+		op->result = -errno;
+	} else {
+		read_fd_sync(op);
+		close(op->fd);
+	}
+
+	op->fd = -1;
+}
+
+static void rename_sync(FileOp *op)
+{
+	op->result = rename(op->path, op->new_path) < 0 ? -errno : 0;
+}
+
+static void unlink_sync(FileOp *op)
+{
+	op->result = unlink(op->path) < 0 ? -errno : 0;
+}
+
+static void rename_or_unlink_sync(FileOp *op)
+{
+	if (op->type == FILE_OP_UNLINK) {
+		unlink_sync(op);
+	} else {
+		rename_sync(op);
+	}
+}
+
+// execute all operations that are still pending, either because io_uring is
+// not used for them or because io_uring_enter failed before they completed
+static void run_sync(FileOp *ops, size_t op_count)
+{
+	size_t i;
+	bool failed = false;
+
+	// all stats and reads first, then all renames and unlinks in order, same
+	// as with io_uring
+	for (i = 0; i < op_count; ++i) {
+		if (!is_lookup(&ops[i])) {
+			continue;
+		}
+
+		if (ops[i].stat_result == RESULT_PENDING) {
+			stat_sync(&ops[i]);
+		}
+
+		if (ops[i].result == RESULT_PENDING) {
+			read_sync(&ops[i]);
+		}
+	}
+
+	for (i = 0; i < op_count; ++i) {
+		if (is_lookup(&ops[i])) {
+			continue;
+		}
+
+		if (ops[i].result == RESULT_PENDING) {
+			if (failed) {
+				ops[i].result = -ECANCELED;
+			} else {
+				rename_or_unlink_sync(&ops[i]);
+			}
+		}
+
+		failed = failed || ops[i].result < 0;
+	}
+}
+
+static void reset_results(FileOp *ops, size_t op_count)
+{
+	size_t i;
+
+	for (i = 0; i < op_count; ++i) {
+		ops[i].stat_result = is_lookup(&ops[i]) ? RESULT_PENDING : 0;
+		ops[i].result = ops[i].type == FILE_OP_STAT ? 0 : RESULT_PENDING;
+		ops[i].fd = -1;
+	}
+}
+
+#ifdef HAVE_IO_URING
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static bool is_op_supported(const struct io_uring_probe *probe, uint8_t opcode)
+{
+	return opcode < probe->ops_len && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+}
+
+// ask the kernel once which opcodes it supports. reads need statx, openat, read
+// and close (Linux 5.6), renames and unlinks need renameat and unlinkat (Linux
+// 5.11). the probe itself needs Linux 5.6, without it nothing is used
+static void probe_ops(FileBatch *batch)
+{
+	struct io_uring_probe *probe;
+	size_t probe_length = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+
+	probe = calloc(1, probe_length);
+
+	if (probe == NULL) {
+		return;
+	}
+
+	if (io_uring_register(batch->ring_fd, IORING_REGISTER_PROBE, probe, 256) >= 0) {
+		batch->uring_reads = is_op_supported(probe, IORING_OP_STATX) &&
+		                     is_op_supported(probe, IORING_OP_OPENAT) &&
+		                     is_op_supported(probe, IORING_OP_READ) &&
+		                     is_op_supported(probe, IORING_OP_CLOSE);
+		batch->uring_renames = is_op_supported(probe, IORING_OP_RENAMEAT) &&
+		                       is_op_supported(probe, IORING_OP_UNLINKAT);
+	}
+
+	free(probe);
+}
+
+bool file_batch_init(FileBatch *batch, bool uring)
+{
+	struct io_uring_params params;
+	uint8_t *sq_ring;
+	uint8_t *cq_ring;
+
+	memset(batch, 0, sizeof(*batch));
+
+	batch->ring_fd = -1;
+
+	if (!uring) {
+		return false;
+	}
+
+	memset(&params, 0, sizeof(params));
+
+	batch->ring_fd = io_uring_setup(FILE_BATCH_RING_LENGTH, &params);
+
+	if (batch->ring_fd < 0) {
+		batch->ring_fd = -1;
+
+		return false;
+	}
+
+	batch->sq_ring_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	batch->cq_ring_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	batch->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		if (batch->cq_ring_length > batch->sq_ring_length) {
+			batch->sq_ring_length = batch->cq_ring_length;
+		}
+
+		batch->cq_ring_length = 0;
+	}
+
+	batch->sq_ring = mmap(NULL, batch->sq_ring_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                      batch->ring_fd, IORING_OFF_SQ_RING);
+
+	if (batch->sq_ring == MAP_FAILED) {
+		batch->sq_ring = NULL;
+
+		goto error;
+	}
+
+	if (batch->cq_ring_length == 0) {
+		batch->cq_ring = batch->sq_ring;
+	} else {
+		batch->cq_ring = mmap(NULL, batch->cq_ring_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                      batch->ring_fd, IORING_OFF_CQ_RING);
+
+		if (batch->cq_ring == MAP_FAILED) {
+			batch->cq_ring = NULL;
+
+			goto error;
+		}
+	}
+
+	batch->sqes = mmap(NULL, batch->sqes_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                   batch->ring_fd, IORING_OFF_SQES);
+
+	if (batch->sqes == MAP_FAILED) {
+		batch->sqes = NULL;
+
+		goto error;
+	}
+
+	sq_ring = batch->sq_ring;
+	cq_ring = batch->cq_ring;
+
+	batch->sq_head = (unsigned *)(sq_ring + params.sq_off.head);
+	batch->sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+	batch->sq_ring_mask = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+	batch->sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+	batch->cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+	batch->cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+	batch->cq_ring_mask = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+	batch->cqes = cq_ring + params.cq_off.cqes;
+
+	probe_ops(batch);
+
+	if (!batch->uring_reads && !batch->uring_renames) {
+		goto error;
+	}
+
+	batch->uring = true;
+
+	return true;
+
+error:
+	file_batch_free(batch);
+
+	return false;
+}
+
+void file_batch_free(FileBatch *batch)
+{
+	if (batch->sqes != NULL) {
+		munmap(batch->sqes, batch->sqes_length);
+	}
+
+	if (batch->cq_ring != NULL && batch->cq_ring != batch->sq_ring) {
+		munmap(batch->cq_ring, batch->cq_ring_length);
+	}
+
+	if (batch->sq_ring != NULL) {
+		munmap(batch->sq_ring, batch->sq_ring_length);
+	}
+
+	if (batch->ring_fd >= 0) {
+		close(batch->ring_fd);
+	}
+
+	memset(batch, 0, sizeof(*batch));
+
+	batch->ring_fd = -1;
+}
+
+static struct io_uring_sqe *get_sqe(FileBatch *batch, unsigned *tail)
+{
+	unsigned index = *tail & *batch->sq_ring_mask;
+	struct io_uring_sqe *sqe = &((struct io_uring_sqe *)batch->sqes)[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	batch->sq_array[index] = index;
+	++*tail;
+
+	return sqe;
+}
+
+// store the result of each posted CQE. the user_data of each SQE is the
+// address of the int that receives the result
+static void reap_cqes(FileBatch *batch, unsigned *count)
+{
+	unsigned head = *batch->cq_head;
+	struct io_uring_cqe *cqe;
+
+	while (head != __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &((struct io_uring_cqe *)batch->cqes)[head & *batch->cq_ring_mask];
+
+		*(int *)(uintptr_t)cqe->user_data = cqe->res;
+
+		++head;
+		--*count;
+	}
+
+	__atomic_store_n(batch->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// submit the prepared SQEs and wait for all of them to complete. on error the
+// results of the operations that didn't complete are left at RESULT_PENDING
+static int submit_and_wait(FileBatch *batch, unsigned tail, unsigned count)
+{
+	unsigned to_submit = count;
+	int rc;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	__atomic_store_n(batch->sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (count > 0) {
+		rc = io_uring_enter(batch->ring_fd, to_submit, count, IORING_ENTER_GETEVENTS);
+
+		if (rc < 0) {
+			rc = errno;
+
+			// completions posted before the error still count
+			reap_cqes(batch, &count);
+
+			// keep waiting for submitted operations if the kernel only asks to
+			// try again, otherwise they might run twice
+			if (rc == EINTR || ((rc == EAGAIN || rc == EBUSY) && count > to_submit)) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		to_submit -= rc;
+
+		reap_cqes(batch, &count);
+	}
+
+	return 0;
+}
+
+static int run_reads(FileBatch *batch, FileOp **ops, size_t op_count)
+{
+	size_t i;
+	unsigned tail;
+	struct io_uring_sqe *sqe;
+	int results[FILE_BATCH_RING_LENGTH];
+	unsigned count = 0;
+	bool second_round;
+	int rc;
+
+	// first round trip: statx and openat, a stat only needs the statx
+	tail = *batch->sq_tail;
+
+	for (i = 0; i < op_count; ++i) {
+		sqe = get_sqe(batch, &tail);
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)ops[i]->path;
+		sqe->len = STATX_MASK;
+		sqe->off = (uintptr_t)&ops[i]->statx;
+		sqe->user_data = (uintptr_t)&ops[i]->stat_result;
+
+		++count;
+
+		if (ops[i]->type == FILE_OP_STAT) {
+			continue;
+		}
+
+		ops[i]->fd = RESULT_PENDING;
+
+		sqe = get_sqe(batch, &tail);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)ops[i]->path;
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		sqe->user_data = (uintptr_t)&ops[i]->fd;
+
+		++count;
+	}
+
+	rc = submit_and_wait(batch, tail, count);
+	second_round = rc == 0;
+
+	// second round trip: read linked with close. skipped if the first one
+	// failed, then the opened files are read synchronously below
+	tail = *batch->sq_tail;
+	count = 0;
+
+	for (i = 0; second_round && i < op_count; ++i) {
+		if (ops[i]->fd < 0) {
+			continue;
+		}
+
+		results[count] = RESULT_PENDING;
+
+		sqe = get_sqe(batch, &tail);
+		sqe->opcode = IORING_OP_READ;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->fd = ops[i]->fd;
+		sqe->addr = (uintptr_t)ops[i]->buffer;
+		sqe->len = get_read_length(ops[i]);
+		sqe->off = 0;
+		sqe->user_data = (uintptr_t)&results[count];
+
+		++count;
+
+		results[count] = RESULT_PENDING;
+
+		sqe = get_sqe(batch, &tail);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = ops[i]->fd;
+		sqe->user_data = (uintptr_t)&results[count];
+
+		++count;
+	}
+
+	if (second_round) {
+		rc = submit_and_wait(batch, tail, count);
+	}
+
+	count = 0;
+
+	// a pending statx or openat is left to run_sync, a pending read or close
+	// of an opened file is executed synchronously here
+	for (i = 0; i < op_count; ++i) {
+		if (ops[i]->type == FILE_OP_STAT) {
+			continue;
+		}
+
+		if (ops[i]->fd >= 0) {
+			if (second_round && results[count] != RESULT_PENDING) {
+				ops[i]->result = results[count];
+			} else {
+				read_fd_sync(ops[i]);
+			}
+
+			// a failed or short read cancels the linked close. a close that
+			// failed otherwise already released the file descriptor
+			if (!second_round || results[count + 1] == RESULT_PENDING || results[count + 1] == -ECANCELED) {
+				close(ops[i]->fd);
+			}
+
+			if (second_round) {
+				count += 2;
+			}
+		} else if (ops[i]->fd != RESULT_PENDING) {
+			ops[i]->result = ops[i]->fd;
+		}
+
+		ops[i]->fd = -1;
+	}
+
+	return rc;
+}
+
+static int run_renames(FileBatch *batch, FileOp **ops, size_t op_count)
+{
+	size_t i;
+	unsigned tail;
+	struct io_uring_sqe *sqe;
+	int results[FILE_BATCH_RING_LENGTH];
+	int rc;
+
+	tail = *batch->sq_tail;
+
+	for (i = 0; i < op_count; ++i) {
+		results[i] = RESULT_PENDING;
+
+		sqe = get_sqe(batch, &tail);
+		sqe->flags = i + 1 < op_count ? IOSQE_IO_LINK : 0;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)ops[i]->path;
+		sqe->user_data = (uintptr_t)&results[i];
+
+		if (ops[i]->type == FILE_OP_UNLINK) {
+			sqe->opcode = IORING_OP_UNLINKAT;
+		} else {
+			sqe->opcode = IORING_OP_RENAMEAT;
+			sqe->len = AT_FDCWD;
+			sqe->off = (uintptr_t)ops[i]->new_path;
+		}
+	}
+
+	rc = submit_and_wait(batch, tail, op_count);
+
+	// pending ones are left to run_sync. not every kernel cancels the rest of
+	// the chain after a failed renameat or unlinkat, so the results are taken
+	// as reported instead of assuming -ECANCELED
+	for (i = 0; i < op_count; ++i) {
+		ops[i]->result = results[i];
+	}
+
+	return rc;
+}
+
+void file_batch_run(FileBatch *batch, FileOp *ops, size_t op_count)
+{
+	FileOp *chunk[FILE_BATCH_RING_LENGTH];
+	size_t chunk_length = 0;
+	size_t chunk_capacity;
+	int pass;
+	bool reads;
+	bool failed = false;
+	size_t i;
+	size_t k;
+	int rc;
+
+	reset_results(ops, op_count);
+
+	// all reads first, then all renames and unlinks, each in chunks that fit
+	// into the ring. reads are independent, renames and unlinks keep their
+	// order and are not submitted anymore after one failed
+	for (pass = 0; pass < 2; ++pass) {
+		reads = pass == 0;
+
+		if (!batch->uring || !(reads ? batch->uring_reads : batch->uring_renames)) {
+			continue;
+		}
+
+		// a read takes up to two SQEs per round trip
+		chunk_capacity = reads ? FILE_BATCH_RING_LENGTH / 2 : FILE_BATCH_RING_LENGTH;
+
+		for (i = 0; i <= op_count && !failed; ++i) {
+			if (chunk_length > 0 && (i == op_count || chunk_length == chunk_capacity)) {
+				if (reads) {
+					rc = run_reads(batch, chunk, chunk_length);
+				} else {
+					rc = run_renames(batch, chunk, chunk_length);
+
+					for (k = 0; k < chunk_length; ++k) {
+						failed = failed || chunk[k]->result < 0;
+					}
+				}
+
+				chunk_length = 0;
+
+				// io_uring_enter failed as a whole, don't use io_uring anymore.
+				// only the operations that are still pending are left to run_sync
+				if (rc < 0) {
+					file_batch_free(batch);
+
+					break;
+				}
+			}
+
+			if (i < op_count && is_lookup(&ops[i]) == reads) {
+				chunk[chunk_length++] = &ops[i];
+			}
+		}
+
+		chunk_length = 0;
+	}
+
+	// operations without io_uring support and the ones left pending above
+	run_sync(ops, op_count);
+}
+
+#else
+
+bool file_batch_init(FileBatch *batch, bool uring)
+{
+	(void)uring;
+
+	memset(batch, 0, sizeof(*batch));
+
+	batch->ring_fd = -1;
+
+	return false;
+}
+
+void file_batch_free(FileBatch *batch)
+{
+	(void)batch;
+}
+
+void file_batch_run(FileBatch *batch, FileOp *ops, size_t op_count)
+{
+	(void)batch;
+
+	reset_results(ops, op_count);
+	run_sync(ops, op_count);
+}
+
+#endif
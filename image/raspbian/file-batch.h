@@ -0,0 +1,91 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+// batched file operations. with io_uring all stats and reads of a batch are
+// submitted together (statx and openat in one round trip, read and close in a
+// second)
+// and renames and unlinks are submitted as one linked chain. without io_uring, or if the
+// kernel doesn't support the opcodes (probed once at init), the same operations are
+// executed with plain blocking syscalls
+
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FILE_BATCH_RING_LENGTH 64
+
+typedef enum {
+	FILE_OP_READ = 0, // stat, open and read path into buffer, up to its size
+	FILE_OP_STAT, // only stat path, in the same round trip as the reads
+	FILE_OP_RENAME, // rename path to new_path, executed in order
+	FILE_OP_UNLINK // unlink path, executed in order with the renames
+} FileOpType;
+
+typedef struct {
+	FileOpType type;
+	const char *path;
+	const char *new_path; // only for FILE_OP_RENAME
+	void *buffer; // only for FILE_OP_READ
+	size_t buffer_length;
+
+	// results, negative errno on error
+	int stat_result; // only for FILE_OP_READ and FILE_OP_STAT
+	struct statx statx;
+	ssize_t result; // number of bytes read or 0 for stat, rename and unlink
+
+	int fd; // internal
+} FileOp;
+
+typedef struct {
+	bool uring; // use io_uring if available
+	bool uring_reads; // kernel supports statx, openat, read and close
+	bool uring_renames; // kernel supports renameat and unlinkat
+	int ring_fd;
+	void *sq_ring;
+	size_t sq_ring_length;
+	void *cq_ring;
+	size_t cq_ring_length;
+	void *sqes;
+	size_t sqes_length;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_ring_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_ring_mask;
+	void *cqes;
+} FileBatch;
+
+// try to set up io_uring if uring is true, returns false if the synchronous
+// fallback is used
+bool file_batch_init(FileBatch *batch, bool uring);
+void file_batch_free(FileBatch *batch);
+
+// execute all operations, renames and unlinks stop at the first error and the
+// remaining ones fail with -ECANCELED. with io_uring the ones already submitted
+// in the same chain might still complete, their actual result is reported then
+void file_batch_run(FileBatch *batch, FileOp *ops, size_t op_count);
+
+#endif
@@ -28,6 +28,7 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -36,82 +37,276 @@
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/random.h>
+#include <linux/random.h>
 #include <crypt.h>
+#include <pthread.h>
 #include <sys/utsname.h>
 #include <libkmod.h>
 #include <zlib.h>
 #include <sys/ioctl.h>
-#include <linux/i2c.h>
-#include <linux/i2c-dev.h>
 #include <dirent.h>
 #include <sys/socket.h>
 #include <linux/sockios.h>
 #include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
 #include <linux/ethtool.h>
 #include <net/if.h>
 #include <linux/rtc.h>
+#include <linux/magic.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/swap.h>
+#include <sys/sysinfo.h>
 #include <libmount.h>
 
+#include "eeprom.h"
+#include "file-batch.h"
+
 #define RTC_PATH "/dev/rtc0"
-#define EEPROM_PATH "/dev/i2c-1"
-#define EEPROM_ADDRESS 0x50
-#define EEPROM_MAGIC_NUMBER 0x21474E54
 #define ACCOUNT_NAME "tng"
 #define DEFAULT_PASSWORD "default-tng-password"
 #define SHADOW_PATH "/mnt/etc/shadow"
 #define SHADOW_BACKUP_PATH SHADOW_PATH"-"
 #define SHADOW_TMP_PATH SHADOW_PATH"+"
-#define SHADOW_BUFFER_LENGTH (512 * 1024)
+#define SHADOW_WINDOW_LENGTH 4096
+#define SHADOW_ENTRY_LENGTH 1024
 #define SHADOW_ENCRYPTED_LENGTH 512
-#define ETHERNET_DEVICE_PATH "/sys/devices/platform/soc/3f980000.usb/usb1/1-1/1-1.7/1-1.7:1.0/"
-#define ETHERNET_CONFIG_LENGTH 256
+#define SHADOW_ACCOUNT_LENGTH 32
+#define PASSWORD_REPLACEMENT_COUNT (1 + EEPROM_ACCOUNT_COUNT)
+#define PASSWORD_VERDICT_PATH "/mnt/etc/tng-base-password-verdict"
+#define PASSWORD_VERDICT_MAGIC_NUMBER 0x21565054 // TPV!
+#define STAGED_RENAME_COUNT 16
+#define UPDATED_FILE_COUNT 16
+#define UPDATED_FILE_LENGTH 512
+#define GENERATED_DIGEST_PATH "/mnt/etc/tng-base-digest"
+#define GENERATED_DIGEST_MAGIC_NUMBER 0x21474454 // TDG!
+#define RANDOM_SEED_DIRECTORY "/mnt/var/lib/tng-base"
+#define RANDOM_SEED_PATH RANDOM_SEED_DIRECTORY"/random-seed"
+#define RANDOM_SEED_LENGTH 512
+#define RANDOM_WAIT_TIMEOUT 500 // milliseconds
+#define CPUFREQ_PATH "/sys/devices/system/cpu/cpufreq"
+#define CPU_POLICY_COUNT 8
+#define ZRAM_CONFIG_PATH "/mnt/etc/tng-base-zram"
+#define ZRAM_SWAP_PRIORITY 100 // prefer over any swap file on the SD card
+#define VARLOG_PATH "/mnt/var/log"
+#define VARLOG_PERSISTENT_PATH "/mnt/var/log.persistent"
+#define VARLOG_COPY_LENGTH 65536
+#define IRQ_CONFIG_PATH "/mnt/etc/tng-base-irq"
+#define IRQ_CPUSET_PATH EEPROM_CACHE_DIRECTORY"/cpuset"
+#define IRQ_SYSTEMD_CONFIG_DIRECTORY "/run/systemd/system.conf.d"
+#define IRQ_SYSTEMD_CONFIG_PATH IRQ_SYSTEMD_CONFIG_DIRECTORY"/tng-base-irq.conf"
+#define USB_POWER_CONFIG_PATH "/mnt/etc/tng-base-usb-power"
+#define USB_POWER_UDEV_RULES_DIRECTORY "/run/udev/rules.d"
+#define USB_POWER_UDEV_RULES_PATH USB_POWER_UDEV_RULES_DIRECTORY"/70-tng-base-usb-power.rules"
+#define USB_POWER_RULE_COUNT 16
+#define USB_POWER_KEEP -2 // setting not given by a rule
+#define BRICK_VENDOR_ID "16d0"
+#define BRICK_PRODUCT_ID "063d"
+#define INIT_ARG_COUNT 32
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define ETHERNET_VENDOR_ID "0424" // LAN7500
+#define ETHERNET_PRODUCT_ID "7500"
+#define ETHERNET_DISCOVERY_TIMEOUT 5000 // milliseconds
+#define ETHERNET_MODULE "smsc75xx"
+#define ETHERNET_UEVENT_PRODUCT "PRODUCT=424/7500/" // USB uevents have VID/PID without leading zeros
+#define ETHERNET_CARRIER_TIMEOUT 4000 // milliseconds after loading the driver, autonegotiation takes about 2 to 3 sec
+#define ETHERNET_CONFIG_CHUNK_LENGTH 32
+#define ETHERNET_CONFIG_MERGE_GAP 8 // merge differing ranges with smaller gaps
+#define ETHERNET_CONFIG_WRITE_TIMEOUT 500 // milliseconds
+
+// remembers that an account entry in /etc/shadow was already checked and does
+// not have the default password set. only this outcome is cached, because the
+// other outcome leads to /etc/shadow being replaced
+typedef struct {
+	uint32_t magic_number; // magic number 0x21565054 (TPV!)
+	uint64_t device; // identity of /etc/shadow
+	uint64_t inode;
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint32_t entry_checksum; // zlib CRC32 checksum over the account entry line
+} __attribute__((packed)) PasswordVerdict;
+
+// stored on root, the 32-bit and the 64-bit init have to agree on the layout
+_Static_assert(sizeof(PasswordVerdict) == 48, "PasswordVerdict has wrong size");
+
+typedef struct {
+	const char *account;
+	const char *default_password; // password the account is expected to have
+	const char *replacement; // /etc/shadow password entry replacing the default password
+	off_t entry_offset; // -1 if the account is not present
+	char entry[SHADOW_ENTRY_LENGTH + 1]; // +1 for null-terminator
+	size_t entry_length;
+	size_t encrypted_begin; // offset of the encrypted section in entry
+	size_t encrypted_end;
+	uint32_t entry_checksum;
+	char salt[SHADOW_ENCRYPTED_LENGTH]; // over-allocate to be safe
+	char encrypted[SHADOW_ENCRYPTED_LENGTH];
+	pthread_t thread;
+	bool check; // crypt comparison required
+	bool not_default; // account does not have the default password set
+	bool replace;
+} PasswordReplacement;
+
+// file updates are staged as fully written but not yet synced temporary files
+// and committed together: one syncfs to make all temporary files durable, then
+// all renames, then one more syncfs to make the renames durable. a removal is
+// staged as a rename without temporary file
+typedef struct {
+	char tmp_path[256]; // empty to remove path
+	char path[256];
+} StagedRename;
+
+typedef enum {
+	PHASE_ENTROPY = 0,
+	PHASE_RTC,
+	PHASE_EEPROM,
+	PHASE_PASSWORD,
+	PHASE_ETHERNET,
+	PHASE_FILES,
+	PHASE_ZRAM,
+	PHASE_VARLOG,
+	PHASE_IRQ,
+	PHASE_USB,
+	PHASE_COUNT
+} Phase;
+
+// options from /proc/cmdline. the tng.* options tune the boot per unit:
+//
+//   tng.skip=<phase>[,<phase>...]  skip phases (entropy, rtc, eeprom, password, ethernet, files, zram, varlog, irq, usb)
+//   tng.force                      ignore cached verdicts and digests, check everything
+//   tng.budget.<phase>=<msec>      report phases taking longer than the budget
+//   tng.loglevel=<0|1|2>           0 panics only, 1 adds errors, 2 adds info (default)
+//   tng.uring=<0|1>                use io_uring for file operations (default 1)
+//   tng.performance=<0|1>          use the performance cpufreq governor during boot (default 1)
+//   tng.governor=<governor>        cpufreq governor to hand over, default is to restore the original one
+//   tng.nice=<-20..19>             nice value of init and its threads during boot (default 0)
+//   tng.zram.size=<size>           zram swap size in bytes with optional K, M, G or % (of RAM) suffix
+//   tng.zram.algorithm=<name>      zram compression algorithm (default is the kernel default)
+//   tng.varlog.size=<size>         RAM-backed /var/log size with optional K, M, G or % (of RAM) suffix
+//   tng.irq.usb=<cpus>             CPU list (e.g. 3 or 2-3) for the USB interrupts, services get the other CPUs
+//
+// the zram options can also be given as size= and algorithm= lines in
+// /etc/tng-base-zram on the root, the irq option as usb= line in
+// /etc/tng-base-irq. the command line takes precedence
+typedef struct {
+	const char *root;
+	const char *rootfstype;
+	const char *rootflags; // passed to libmount as mount options
+	bool ro;
+	int rootdelay; // seconds, -1 if not set
+	const char *init;
+	const char *init_args[INIT_ARG_COUNT + 1]; // +1 for NULL-terminator
+	size_t init_arg_count;
+	uint32_t skip; // bitmask of phases
+	bool force;
+	uint32_t budgets[PHASE_COUNT]; // milliseconds, 0 if not set
+	int log_level;
+	bool uring;
+	bool performance;
+	const char *governor; // NULL to restore
+	int nice;
+	const char *zram_size; // NULL if not set
+	const char *zram_algorithm; // NULL if not set
+	const char *varlog_size; // NULL if not set
+	const char *irq_usb; // NULL if not set
+} Cmdline;
 
 typedef struct {
-	uint32_t magic_number; // magic number 0x21474E54 (TNG!)
-	uint32_t checksum; // zlib CRC32 checksum over all following bytes
-	uint16_t data_length; // length of data blocks in byte
-	uint8_t data_version; // indicating the available data blocks
-} __attribute__((packed)) EEPROM_Header;
+	char path[PATH_MAX]; // scaling_governor file of a cpufreq policy
+	char governor[32]; // original governor
+} CpuPolicy;
 
+// matches USB devices by VID/PID or by port path (the device name in
+// /sys/bus/usb/devices, e.g. 1-1.3). a setting is USB_POWER_KEEP if the rule
+// doesn't change it
 typedef struct {
-	uint32_t production_date; // BCD formatted production date (0x20200827 -> 2020-08-27), exposed at /etc/tng-base-production-date
-	char uid[7]; // null-terminated unique identifier, exposed at /etc/tng-base-uid
-	char hostname[65]; // null-terminated /etc/hostname entry, also exposed at /etc/tng-base-hostname
-	char encrypted_password[107]; // null-terminated /etc/shadow password entry
-	uint8_t ethernet_config[ETHERNET_CONFIG_LENGTH]; // config for Ethernet chip
-} __attribute__((packed)) EEPROM_DataV1;
+	char vendor_id[5]; // empty if matched by port
+	char product_id[5];
+	char port[32]; // empty if matched by VID/PID
+	int control; // 1 for on, 0 for auto
+	int autosuspend_delay; // milliseconds, -1 disables autosuspend
+	int lpm; // USB 2.0 hardware link power management, 0 or 1
+} UsbPowerRule;
 
 typedef struct {
-	EEPROM_Header header;
-	EEPROM_DataV1 data_v1;
-} __attribute__((packed)) EEPROM;
+	const char *path;
+	mode_t mode;
+	char content[UPDATED_FILE_LENGTH];
+	size_t content_length;
+	bool removed; // remove the file instead of updating it
+} UpdatedFile;
+
+// a file derived from the EEPROM data. the formatter writes the file content
+// and returns its length, or -1 if the file cannot be derived from the data
+typedef struct {
+	const char *path;
+	mode_t mode;
+	uint16_t data_version; // minimum EEPROM data version
+	int (*format)(char *buffer, size_t buffer_length);
+} GeneratedFile;
+
+// remembers the content of all generated files. if it matches on boot the
+// generated files are not read at all
+typedef struct {
+	uint32_t magic_number; // magic number 0x21474454 (TDG!)
+	uint32_t checksum; // zlib CRC32 checksum over path, mode and content of all generated files
+} __attribute__((packed)) GeneratedDigest;
+
+_Static_assert(sizeof(GeneratedDigest) == 8, "GeneratedDigest has wrong size");
 
 static int kmsg_fd = -1;
 static EEPROM eeprom;
 static bool eeprom_valid = false;
+static uint8_t eeprom_blob[EEPROM_MAX_LENGTH];
+static size_t eeprom_blob_length = 0;
+static StagedRename staged_renames[STAGED_RENAME_COUNT];
+static size_t staged_rename_count = 0;
+static FileBatch file_batch;
+static Cmdline cmdline = {.log_level = LOG_LEVEL_INFO}; // log everything until /proc/cmdline is parsed
+static const char *phase_names[PHASE_COUNT] = {"entropy", "rtc", "eeprom", "password", "ethernet", "files", "zram", "varlog", "irq", "usb"};
+static uint64_t phase_start;
+static CpuPolicy cpu_policies[CPU_POLICY_COUNT];
+static size_t cpu_policy_count = 0;
+static const char *log_name = "initramfs";
+static pthread_t ethernet_driver_thread;
+static bool ethernet_driver_started = false;
+static bool ethernet_driver_finished = false; // the driver thread ran and was joined
+static char ethernet_interface[IFNAMSIZ]; // empty if the interface didn't show up
+static uint64_t ethernet_driver_loaded; // milliseconds
+static bool ethernet_device_missing = false; // don't wait for it again in configure_ethernet
+static pthread_t ethernet_carrier_thread;
+static bool ethernet_carrier_started = false;
+static dev_t password_verdict_device = 0; // stored instead of the device of /etc/shadow, if not 0
 
 static void print(const char *format, ...) __attribute__((format(printf, 1, 2)));
 static void panic(const char *format, ...) __attribute__((format(printf, 1, 2)));
 
-static void vprint(const char *prefix, const char *format, va_list ap)
+static void vprint(int log_level, const char *prefix, const char *format, va_list ap)
 {
 	char message[512];
 	char buffer[512];
 	int ignored;
 
+	if (log_level > cmdline.log_level) {
+		return;
+	}
+
 	vsnprintf(message, sizeof(message), format, ap);
 
 	if (kmsg_fd < 0) {
-		printf("initramfs: %s%s\n", prefix, message);
+		printf("%s: %s%s\n", log_name, prefix, message);
 	} else {
-		snprintf(buffer, sizeof(buffer), "initramfs: %s%s\n", prefix, message);
+		snprintf(buffer, sizeof(buffer), "%s: %s%s\n", log_name, prefix, message);
 
 		ignored = write(kmsg_fd, buffer, strlen(buffer)); // FIXME: error handling
 
@@ -124,7 +319,7 @@ static void print(const char *format, ...)
 	va_list ap;
 
 	va_start(ap, format);
-	vprint("", format, ap);
+	vprint(LOG_LEVEL_INFO, "", format, ap);
 	va_end(ap);
 }
 
@@ -133,7 +328,7 @@ static void error(const char *format, ...)
 	va_list ap;
 
 	va_start(ap, format);
-	vprint("error: ", format, ap);
+	vprint(LOG_LEVEL_ERROR, "error: ", format, ap);
 	va_end(ap);
 }
 
@@ -145,10 +340,14 @@ static void panic(const char *format, ...)
 
 	if (format != NULL) {
 		va_start(ap, format);
-		vprint("panic: ", format, ap);
+		vprint(0, "panic: ", format, ap);
 		va_end(ap);
 	}
 
+#ifdef TNG_PROVISION
+	exit(EXIT_FAILURE); // running on the host as part of tng-provision, nothing to reboot
+#endif
+
 	// ensure /proc is mounted
 	if (mkdir("/proc", 0775) < 0) {
 		if (errno != EEXIST) {
@@ -199,7 +398,21 @@ static void panic(const char *format, ...)
 	}
 }
 
-static void robust_mount(const char *source, const char *target, const char *type, unsigned long flags)
+static uint64_t microseconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t milliseconds(void)
+{
+	return microseconds() / 1000;
+}
+
+static void robust_mount(const char *source, const char *target, const char *type, unsigned long flags, const char *options)
 {
 	struct libmnt_context *ctx;
 	int rc;
@@ -207,7 +420,7 @@ static void robust_mount(const char *source, const char *target, const char *typ
 	int ex;
 	size_t retries = 0;
 
-	print("mounting %s (%s) at %s", source, type, target);
+	print("mounting %s (%s) at %s with options '%s'", source, type, target, options != NULL ? options : "");
 
 retry:
 	ctx = mnt_new_context();
@@ -246,6 +459,14 @@ retry:
 		panic("could not set libmount flags to 0x%08lx: %s (%d)", flags, strerror(-rc), -rc);
 	}
 
+	if (options != NULL) {
+		rc = mnt_context_set_options(ctx, options);
+
+		if (rc < 0) {
+			panic("could not set libmount options to %s: %s (%d)", options, strerror(-rc), -rc);
+		}
+	}
+
 	rc = mnt_context_mount(ctx);
 
 	if (rc != 0) {
@@ -301,6 +522,62 @@ static int create_file(const char *path, uid_t uid, gid_t gid, mode_t mode)
 	return fd;
 }
 
+// the root is mounted with noatime, unless rootflags selects an atime policy
+// itself, then that policy is left to libmount
+static unsigned long root_atime_flags(void)
+{
+	static const char *const atime_options[] = {
+		"atime", "noatime", "relatime", "norelatime", "strictatime", "nostrictatime"
+	};
+	const char *p;
+	size_t length;
+	size_t i;
+
+	for (p = cmdline.rootflags != NULL ? cmdline.rootflags : ""; *p != '\0'; p += length + (p[length] == ',' ? 1 : 0)) {
+		length = strcspn(p, ",");
+
+		for (i = 0; i < sizeof(atime_options) / sizeof(atime_options[0]); ++i) {
+			if (strlen(atime_options[i]) == length && strncmp(p, atime_options[i], length) == 0) {
+				return 0;
+			}
+		}
+	}
+
+	return MS_NOATIME;
+}
+
+// a remount replaces the mount flags and filesystem options, so the rootflags
+// used for the initial mount have to be given again. libmount splits them into
+// VFS flags and filesystem options, the same way it did for the initial mount
+static void remount_root_read_only(void)
+{
+	unsigned long flags = 0;
+	char *fs_options = NULL;
+	int rc;
+
+	print("remounting /mnt read-only");
+
+	if (cmdline.rootflags != NULL) {
+		rc = mnt_optstr_get_flags(cmdline.rootflags, &flags, mnt_get_builtin_optmap(MNT_LINUX_MAP));
+
+		if (rc < 0) {
+			panic("could not get mount flags from %s: %s (%d)", cmdline.rootflags, strerror(-rc), -rc);
+		}
+
+		rc = mnt_split_optstr(cmdline.rootflags, NULL, NULL, &fs_options, 1, 1);
+
+		if (rc < 0) {
+			panic("could not split mount options %s: %s (%d)", cmdline.rootflags, strerror(-rc), -rc);
+		}
+	}
+
+	if (mount(NULL, "/mnt", NULL, MS_REMOUNT | MS_RDONLY | root_atime_flags() | flags, fs_options) < 0) {
+		panic("could not remount /mnt read-only: %s (%d)", strerror(errno), errno);
+	}
+
+	free(fs_options);
+}
+
 static void robust_write(const char *path, int fd, const void *buffer, size_t buffer_length)
 {
 	ssize_t length = write(fd, buffer, buffer_length);
@@ -314,7 +591,97 @@ static void robust_write(const char *path, int fd, const void *buffer, size_t bu
 	}
 }
 
-static void modprobe(const char *name)
+static void stage_rename(const char *tmp_path, const char *path)
+{
+	StagedRename *staged_rename;
+
+	if (staged_rename_count >= STAGED_RENAME_COUNT) {
+		panic("too many staged renames");
+	}
+
+	staged_rename = &staged_renames[staged_rename_count++];
+
+	snprintf(staged_rename->tmp_path, sizeof(staged_rename->tmp_path), "%s", tmp_path);
+	snprintf(staged_rename->path, sizeof(staged_rename->path), "%s", path);
+}
+
+static void stage_removal(const char *path)
+{
+	stage_rename("", path);
+}
+
+static void sync_mnt(int fd)
+{
+	print("syncing /mnt");
+
+	if (syncfs(fd) < 0) {
+		panic("could not sync /mnt: %s (%d)", strerror(errno), errno);
+	}
+}
+
+static void commit_staged_renames(void)
+{
+	int fd;
+	size_t i;
+	size_t failed = staged_rename_count;
+	FileOp ops[STAGED_RENAME_COUNT];
+
+	if (staged_rename_count == 0) {
+		return;
+	}
+
+	fd = open("/mnt", O_RDONLY | O_DIRECTORY);
+
+	if (fd < 0) {
+		panic("could not open /mnt: %s (%d)", strerror(errno), errno);
+	}
+
+	sync_mnt(fd);
+
+	memset(ops, 0, sizeof(ops));
+
+	for (i = 0; i < staged_rename_count; ++i) {
+		if (staged_renames[i].tmp_path[0] == '\0') {
+			print("removing %s", staged_renames[i].path);
+
+			ops[i].type = FILE_OP_UNLINK;
+			ops[i].path = staged_renames[i].path;
+		} else {
+			print("renaming %s to %s", staged_renames[i].tmp_path, staged_renames[i].path);
+
+			ops[i].type = FILE_OP_RENAME;
+			ops[i].path = staged_renames[i].tmp_path;
+			ops[i].new_path = staged_renames[i].path;
+		}
+	}
+
+	file_batch_run(&file_batch, ops, staged_rename_count);
+
+	// the renames after a failed one are canceled, report the one that failed
+	for (i = 0; i < staged_rename_count; ++i) {
+		if (ops[i].result < 0 && (failed == staged_rename_count || ops[failed].result == -ECANCELED)) {
+			failed = i;
+		}
+	}
+
+	if (failed < staged_rename_count) {
+		if (ops[failed].type == FILE_OP_UNLINK) {
+			panic("could not remove %s: %s (%d)",
+			      staged_renames[failed].path, strerror(-ops[failed].result), (int)-ops[failed].result);
+		}
+
+		panic("could not rename %s to %s: %s (%d)",
+		      staged_renames[failed].tmp_path, staged_renames[failed].path, strerror(-ops[failed].result), (int)-ops[failed].result);
+	}
+
+	sync_mnt(fd);
+	close(fd);
+
+	staged_rename_count = 0;
+}
+
+// returns false if the module is not available and not required
+static bool modprobe(const char *name, bool required)
 {
 	int rc;
 	struct utsname utsname;
@@ -347,6 +714,13 @@ static void modprobe(const char *name)
 	}
 
 	if (list == NULL) {
+		if (!required) {
+			print("kernel module %s is not available, skipping", name);
+			kmod_unref(ctx);
+
+			return false;
+		}
+
 		panic("kernel module %s is missing", name);
 	}
 
@@ -362,719 +736,3702 @@ static void modprobe(const char *name)
 	}
 
 	kmod_module_unref_list(list);
+
+	return true;
 }
 
-static int i2c_write16(int fd, uint8_t byte0, uint8_t byte1)
+static uint64_t boot_milliseconds(void)
 {
-	struct i2c_smbus_ioctl_data args;
-	union i2c_smbus_data data;
+	struct timespec ts;
 
-	args.read_write = I2C_SMBUS_WRITE;
-	args.command = byte0;
-	args.size = I2C_SMBUS_BYTE_DATA;
-	args.data = &data;
+	clock_gettime(CLOCK_BOOTTIME, &ts);
 
-	data.byte = byte1;
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	ioctl(fd, BLKFLSBUF);
+static bool is_crng_ready(void)
+{
+	uint8_t byte;
 
-	return ioctl(fd, I2C_SMBUS, &args);
+	return getrandom(&byte, 1, GRND_NONBLOCK) == 1;
 }
 
-static int i2c_read8(int fd, uint8_t *byte)
+// replace the random seed file by a new one via a temporary file. when this
+// returns the replacement is durable, including its directory entry
+static void store_random_seed(const uint8_t *seed, size_t seed_length)
 {
-	struct i2c_smbus_ioctl_data args;
-	union i2c_smbus_data data;
-	int rc;
+	int fd;
+
+	print("storing new %s", RANDOM_SEED_PATH);
 
-	args.read_write = I2C_SMBUS_READ;
-	args.command = 0;
-	args.size = I2C_SMBUS_BYTE;
-	args.data = &data;
+	if (mkdir(RANDOM_SEED_DIRECTORY, 0755) < 0 && errno != EEXIST) {
+		panic("could not create %s: %s (%d)", RANDOM_SEED_DIRECTORY, strerror(errno), errno);
+	}
 
-	ioctl(fd, BLKFLSBUF);
+	fd = create_file(RANDOM_SEED_PATH".tmp", 0, 0, 0600);
 
-	rc = ioctl(fd, I2C_SMBUS, &args);
+	robust_write(RANDOM_SEED_PATH".tmp", fd, seed, seed_length);
 
-	if (rc < 0) {
-		return rc;
+	if (fdatasync(fd) < 0) {
+		panic("could not sync %s: %s (%d)", RANDOM_SEED_PATH".tmp", strerror(errno), errno);
 	}
 
-	*byte = data.byte & 0xFF;
+	close(fd);
 
-	return 0;
+	if (rename(RANDOM_SEED_PATH".tmp", RANDOM_SEED_PATH) < 0) {
+		panic("could not rename %s to %s: %s (%d)", RANDOM_SEED_PATH".tmp", RANDOM_SEED_PATH, strerror(errno), errno);
+	}
+
+	fd = open(RANDOM_SEED_DIRECTORY, O_RDONLY | O_DIRECTORY);
+
+	if (fd < 0) {
+		panic("could not open %s: %s (%d)", RANDOM_SEED_DIRECTORY, strerror(errno), errno);
+	}
+
+	if (fsync(fd) < 0) {
+		panic("could not sync %s: %s (%d)", RANDOM_SEED_DIRECTORY, strerror(errno), errno);
+	}
+
+	close(fd);
 }
 
-static void rtc_hctosys(void)
+// credit the random seed stored in the root to the kernel entropy pool, so the
+// CRNG is initialized before userspace calls getrandom. like
+// systemd-random-seed the old seed is first mixed into the pool without
+// crediting it, then a new seed is read from the pool and atomically replaces
+// the old one before the old one is credited. so the old seed is never credited
+// twice, even if the boot doesn't get any further, and a power loss at any
+// point leaves either the old or the new seed behind. only the seed file itself
+// is synced, so a normal boot doesn't need the syncfs of the staged renames
+static void seed_entropy(void)
 {
 	int fd;
-	struct tm hc_start;
-	struct tm hc_now;
-	time_t timeout_start;
-	time_t timeout_now;
-	struct timeval sys_now;
-	struct tm sys_now_local;
-	int minuteswest;
-	struct timezone tz;
-
-	// read RTC time
-	fd = open(RTC_PATH, O_RDONLY);
+	int random_fd;
+	ssize_t length = 0;
+	struct {
+		struct rand_pool_info info;
+		uint8_t buffer[RANDOM_SEED_LENGTH];
+	} u;
+	uint8_t seed[RANDOM_SEED_LENGTH];
+	bool ready_before = is_crng_ready();
+	struct pollfd pfd;
+	uint64_t timeout;
 
-	if (fd < 0) {
-		error("could not open %s for reading: %s (%d)", RTC_PATH, strerror(errno), errno);
+	// the kernel feeds the hardware RNG into the entropy pool
+	modprobe("bcm2835_rng", false);
 
-		return;
-	}
+	random_fd = open("/dev/random", O_RDWR);
 
-	if (ioctl(fd, RTC_RD_TIME, &hc_start) < 0) {
-		error("could not read RTC time: %s (%d)", strerror(errno), errno);
-		close(fd);
+	if (random_fd < 0) {
+		error("could not open /dev/random: %s (%d)", strerror(errno), errno);
 
 		return;
 	}
 
-	timeout_start = time(NULL);
+	fd = open(RANDOM_SEED_PATH, O_RDONLY);
 
-	while (true) {
-		if (ioctl(fd, RTC_RD_TIME, &hc_now) < 0) {
-			error("could not read RTC time: %s (%d)", strerror(errno), errno);
-			close(fd);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			error("could not open %s: %s (%d)", RANDOM_SEED_PATH, strerror(errno), errno);
+			close(random_fd);
 
 			return;
 		}
 
-		if (hc_start.tm_sec != hc_now.tm_sec) {
-			break;
+		print("%s does not exist yet", RANDOM_SEED_PATH);
+	} else {
+		length = read(fd, u.buffer, sizeof(u.buffer));
+
+		if (length < 0) {
+			error("could not read from %s: %s (%d)", RANDOM_SEED_PATH, strerror(errno), errno);
+
+			length = 0;
 		}
 
-		timeout_now = time(NULL);
+		close(fd);
+	}
 
-		if (timeout_now - timeout_start > 3) {
-			error("RTC time seems to be stuck, cannot set system time");
-			close(fd);
+	if (length > 0) {
+		// writing to /dev/random mixes the old seed in without crediting it, so
+		// the new seed depends on it even if the CRNG is not initialized yet
+		if (write(random_fd, u.buffer, length) != length) {
+			error("could not write %s to /dev/random: %s (%d)", RANDOM_SEED_PATH, strerror(errno), errno);
+		}
 
-			return;
+		fd = open("/dev/urandom", O_RDONLY);
+
+		if (fd < 0) {
+			panic("could not open /dev/urandom: %s (%d)", strerror(errno), errno);
 		}
-	}
 
-	hc_now.tm_isdst = -1; // daylight saving time is undefined
+		if (read(fd, seed, sizeof(seed)) != sizeof(seed)) {
+			panic("could not read from /dev/urandom: %s (%d)", strerror(errno), errno);
+		}
 
-	close(fd);
+		close(fd);
 
-	// set system time
-	sys_now.tv_sec = timegm(&hc_now);
-	sys_now.tv_usec = 0;
+		// make sure the old seed is gone before it's credited
+		store_random_seed(seed, sizeof(seed));
 
-	if (sys_now.tv_sec < 0) {
-		error("could not convert RTC time %d-%02d-%02d %02d:%02d:%02d UTC to system time: %s (%d)",
-		      hc_now.tm_year + 1900, hc_now.tm_mon + 1, hc_now.tm_mday,
-		      hc_now.tm_hour, hc_now.tm_min, hc_now.tm_sec, strerror(errno), errno);
+		print("crediting %zd bytes from %s to the entropy pool", length, RANDOM_SEED_PATH);
 
-		return;
+		u.info.entropy_count = length * 8;
+		u.info.buf_size = length;
+
+		if (ioctl(random_fd, RNDADDENTROPY, &u.info) < 0) {
+			error("could not credit %s to the entropy pool: %s (%d)", RANDOM_SEED_PATH, strerror(errno), errno);
+		}
 	}
 
-	localtime_r(&sys_now.tv_sec, &sys_now_local);
+	// wait for the CRNG, the hardware RNG might still have to deliver
+	timeout = milliseconds() + RANDOM_WAIT_TIMEOUT;
 
-	minuteswest = timezone / 60;
+	while (!is_crng_ready() && milliseconds() < timeout) {
+		pfd.fd = random_fd;
+		pfd.events = POLLIN; // readable once the CRNG is initialized
+		pfd.revents = 0;
 
-	if (sys_now_local.tm_isdst) {
-		minuteswest -= 60;
+		if (poll(&pfd, 1, timeout - milliseconds()) < 0 && errno != EINTR) {
+			break;
+		}
 	}
 
-	tz.tz_minuteswest = minuteswest;
-	tz.tz_dsttime = 0;
+	close(random_fd);
 
-	if (settimeofday(&sys_now, &tz) < 0) {
-		error("could not use RTC time %d-%02d-%02d %02d:%02d:%02d UTC as system time %d-%02d-%02d %02d:%02d:%02d %+03d:%02d: %s (%d)",
-		      hc_now.tm_year + 1900, hc_now.tm_mon + 1, hc_now.tm_mday,
-		      hc_now.tm_hour, hc_now.tm_min, hc_now.tm_sec,
-		      sys_now_local.tm_year + 1900, sys_now_local.tm_mon + 1, sys_now_local.tm_mday,
-		      sys_now_local.tm_hour, sys_now_local.tm_min, sys_now_local.tm_sec,
-		      -minuteswest / 60, abs(minuteswest) % 60,
-		      strerror(errno), errno);
+	if (!is_crng_ready()) {
+		error("CRNG is not initialized after %d msec", RANDOM_WAIT_TIMEOUT);
 
 		return;
 	}
 
-	print("using RTC time %d-%02d-%02d %02d:%02d:%02d UTC as system time %d-%02d-%02d %02d:%02d:%02d %+03d:%02d",
-	      hc_now.tm_year + 1900, hc_now.tm_mon + 1, hc_now.tm_mday,
-	      hc_now.tm_hour, hc_now.tm_min, hc_now.tm_sec,
-	      sys_now_local.tm_year + 1900, sys_now_local.tm_mon + 1, sys_now_local.tm_mday,
-	      sys_now_local.tm_hour, sys_now_local.tm_min, sys_now_local.tm_sec,
-	      -minuteswest / 60, abs(minuteswest) % 60);
+	if (ready_before) {
+		print("CRNG was already initialized");
+	} else {
+		print("CRNG initialized %llu msec after boot", (unsigned long long)boot_milliseconds());
+	}
+
+	// without an old seed there is no replacement yet. the first seed is only
+	// stored from an initialized CRNG
+	if (length == 0) {
+		if (getrandom(seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+			panic("could not get random data: %s (%d)", strerror(errno), errno);
+		}
+
+		store_random_seed(seed, sizeof(seed));
+	}
 }
 
-static void read_eeprom(void)
+static bool read_sysfs(const char *path, char *buffer, size_t buffer_length)
 {
 	int fd;
-	size_t address;
-	union {
-		EEPROM eeprom;
-		uint8_t bytes[sizeof(EEPROM)];
-	} u;
-	uint8_t byte;
-	uint32_t checksum;
-
-	eeprom_valid = false;
-
-	// open I2C bus
-	print("opening %s", EEPROM_PATH);
+	ssize_t length;
 
-	fd = open(EEPROM_PATH, O_RDWR);
+	fd = open(path, O_RDONLY);
 
 	if (fd < 0) {
-		error("could not open %s: %s (%d)", EEPROM_PATH, strerror(errno), errno);
+		error("could not open %s for reading: %s (%d)", path, strerror(errno), errno);
 
-		return;
+		return false;
 	}
 
-	// set slave address
-	if (ioctl(fd, I2C_SLAVE, EEPROM_ADDRESS) < 0) {
-		error("could not set EEPROM slave address to 0x%02X: %s (%d)", EEPROM_ADDRESS, strerror(errno), errno);
-		print("closing %s", EEPROM_PATH);
-		close(fd);
+	length = read(fd, buffer, buffer_length - 1);
 
-		return;
-	}
+	close(fd);
 
-	// set read address to 0
-	if (i2c_write16(fd, 0, 0) < 0) {
-		error("could not set EEPROM read address to zero: %s (%d)", strerror(errno), errno);
-		print("closing %s", EEPROM_PATH);
-		close(fd);
+	if (length < 0) {
+		error("could not read from %s: %s (%d)", path, strerror(errno), errno);
 
-		return;
+		return false;
 	}
 
-	// read header
-	print("reading EEPROM header");
+	buffer[length] = '\0';
+	buffer[strcspn(buffer, "\n")] = '\0';
 
-	for (address = 0; address < sizeof(u.eeprom.header); ++address) {
-		if (i2c_read8(fd, &u.bytes[address]) < 0) {
-			error("could not read EEPROM header at address %zu: %s (%d)", address, strerror(errno), errno);
-			print("closing %s", EEPROM_PATH);
-			close(fd);
+	return true;
+}
 
-			return;
-		}
-	}
+static bool write_sysfs(const char *path, const char *value)
+{
+	int fd;
+	ssize_t length;
 
-	if (u.eeprom.header.magic_number != EEPROM_MAGIC_NUMBER) {
-		error("EEPROM header has wrong magic number: %08X (actual) != %08X (expected)", u.eeprom.header.magic_number, EEPROM_MAGIC_NUMBER);
-		print("closing %s", EEPROM_PATH);
-		close(fd);
+	fd = open(path, O_WRONLY);
 
-		return;
+	if (fd < 0) {
+		error("could not open %s for writing: %s (%d)", path, strerror(errno), errno);
+
+		return false;
 	}
 
-	// read data
-	print("reading EEPROM data");
+	length = write(fd, value, strlen(value));
 
-	checksum = crc32(0, Z_NULL, 0);
-	checksum = crc32(checksum, (uint8_t *)&u.eeprom.header.data_length, sizeof(u.eeprom.header.data_length));
-	checksum = crc32(checksum, (uint8_t *)&u.eeprom.header.data_version, sizeof(u.eeprom.header.data_version));
+	close(fd);
 
-	for (address = sizeof(u.eeprom.header); address < sizeof(u.eeprom.header) + u.eeprom.header.data_length; ++address) {
-		if (i2c_read8(fd, &byte) < 0) {
-			error("could not read EEPROM data at address %zu: %s (%d)", address, strerror(errno), errno);
-			print("closing %s", EEPROM_PATH);
-			close(fd);
+	if (length < 0) {
+		error("could not write '%s' to %s: %s (%d)", value, path, strerror(errno), errno);
 
-			return;
+		return false;
+	}
+
+	return true;
+}
+
+// run the CPU bound work during boot (crypt, libkmod, libblkid) at full clock
+static void enable_performance_profile(void)
+{
+	DIR *dp;
+	struct dirent *dirent;
+	CpuPolicy *policy;
+
+	if (cmdline.nice != 0) {
+		print("setting nice value to %d", cmdline.nice);
+
+		if (setpriority(PRIO_PROCESS, 0, cmdline.nice) < 0) {
+			error("could not set nice value to %d: %s (%d)", cmdline.nice, strerror(errno), errno);
+		}
+	}
+
+	if (!cmdline.performance) {
+		return;
+	}
+
+	dp = opendir(CPUFREQ_PATH);
+
+	if (dp == NULL) {
+		print("cpufreq is not available, keeping CPU clock as is");
+
+		return;
+	}
+
+	while ((dirent = readdir(dp)) != NULL && cpu_policy_count < CPU_POLICY_COUNT) {
+		if (strncmp(dirent->d_name, "policy", 6) != 0) {
+			continue;
+		}
+
+		policy = &cpu_policies[cpu_policy_count];
+
+		snprintf(policy->path, sizeof(policy->path), CPUFREQ_PATH"/%s/scaling_governor", dirent->d_name);
+
+		if (!read_sysfs(policy->path, policy->governor, sizeof(policy->governor))) {
+			continue;
 		}
 
-		if (address < sizeof(u.eeprom)) {
-			u.bytes[address] = byte;
+		if (strcmp(policy->governor, "performance") != 0) {
+			if (!write_sysfs(policy->path, "performance")) {
+				continue;
+			}
+
+			print("switched cpufreq %s from %s to performance governor", dirent->d_name, policy->governor);
 		}
 
-		checksum = crc32(checksum, &byte, sizeof(byte));
+		++cpu_policy_count;
 	}
 
-	print("closing %s", EEPROM_PATH);
+	closedir(dp);
+}
+
+// restore the original governors or hand over the one from tng.governor
+static void restore_performance_profile(void)
+{
+	size_t i;
+	const char *governor;
+
+	for (i = 0; i < cpu_policy_count; ++i) {
+		governor = cmdline.governor != NULL ? cmdline.governor : cpu_policies[i].governor;
+
+		if (strcmp(governor, "performance") != 0 && write_sysfs(cpu_policies[i].path, governor)) {
+			print("switched %s to %s governor", cpu_policies[i].path, governor);
+		}
+	}
+
+	cpu_policy_count = 0;
+
+	// the nice value is inherited by the real init
+	if (cmdline.nice != 0 && setpriority(PRIO_PROCESS, 0, 0) < 0) {
+		error("could not reset nice value: %s (%d)", strerror(errno), errno);
+	}
+}
+
+// parse size with optional K, M, G or % (of total RAM) suffix. sizes larger
+// than the total RAM are rejected, zram and tmpfs sizes are meant to be a part
+// of it
+static bool parse_size(const char *value, uint64_t *size)
+{
+	char *end;
+	unsigned long long number;
+	unsigned int shift = 0;
+	struct sysinfo info;
+	uint64_t total_ram;
+
+	errno = 0;
+	number = strtoull(value, &end, 10);
+
+	if (errno != 0 || end == value || sysinfo(&info) < 0) {
+		return false;
+	}
+
+	total_ram = (uint64_t)info.totalram * info.mem_unit;
+
+	switch (*end) {
+	case '\0': break;
+	case 'K': case 'k': shift = 10; break;
+	case 'M': case 'm': shift = 20; break;
+	case 'G': case 'g': shift = 30; break;
+
+	case '%':
+		if (number > 100 || end[1] != '\0') {
+			return false;
+		}
+
+		*size = total_ram * number / 100;
+
+		return true;
+
+	default:
+		return false;
+	}
+
+	if (*end != '\0' && end[1] != '\0') {
+		return false;
+	}
+
+	if (number > UINT64_MAX >> shift || (uint64_t)number << shift > total_ram) {
+		return false;
+	}
+
+	*size = (uint64_t)number << shift;
+
+	return true;
+}
+
+// write a version 1 swap header (like mkswap) to the first page of a device
+static void format_swap(const char *path, uint64_t size)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint8_t *page;
+	uint32_t *info;
+	int fd;
+
+	page = calloc(1, page_size);
+
+	if (page == NULL) {
+		panic("could not allocate swap header");
+	}
+
+	info = (uint32_t *)(page + 1024); // after the boot block
+	info[0] = 1; // version
+	info[1] = size / page_size - 1; // last page
+	info[2] = 0; // number of bad pages
+
+	if (getrandom(&info[3], 16, GRND_NONBLOCK) != 16) { // UUID
+		memset(&info[3], 0, 16);
+	}
+
+	memcpy(page + page_size - 10, "SWAPSPACE2", 10);
+
+	fd = open(path, O_WRONLY);
+
+	if (fd < 0) {
+		panic("could not open %s for writing: %s (%d)", path, strerror(errno), errno);
+	}
+
+	robust_write(path, fd, page, page_size);
 
 	close(fd);
+	free(page);
+}
 
-	// check header and data
-	if (u.eeprom.header.checksum != checksum) {
-		error("EEPROM header/data has wrong checksum: %08X (actual) != %08X (expected)", checksum, u.eeprom.header.checksum);
+// set up a compressed swap device in RAM, so memory pressure doesn't end up
+// as page cache thrashing on the SD card
+static void setup_zram(void)
+{
+	char line[128];
+	static char config_size[128];
+	static char config_algorithm[128];
+	const char *size_string = cmdline.zram_size;
+	const char *algorithm = cmdline.zram_algorithm;
+	uint64_t size;
+	char buffer[32];
+	char algorithms[256];
+	FILE *fp;
 
-		return;
+	// read config from root, the command line takes precedence
+	fp = fopen(ZRAM_CONFIG_PATH, "rb");
+
+	if (fp == NULL) {
+		if (errno != ENOENT) {
+			error("could not open %s for reading: %s (%d)", ZRAM_CONFIG_PATH, strerror(errno), errno);
+		}
+	} else {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+
+			if (size_string == NULL && strncmp(line, "size=", 5) == 0) {
+				snprintf(config_size, sizeof(config_size), "%s", line + 5);
+
+				size_string = config_size;
+			} else if (algorithm == NULL && strncmp(line, "algorithm=", 10) == 0) {
+				snprintf(config_algorithm, sizeof(config_algorithm), "%s", line + 10);
+
+				algorithm = config_algorithm;
+			}
+		}
+
+		fclose(fp);
 	}
 
-	if (u.eeprom.header.data_version < 1) {
-		error("EEPROM header has invalid data-version: %u (actual) < 1 (expected)", u.eeprom.header.data_version);
+	if (size_string == NULL) {
+		print("zram swap is not configured");
 
 		return;
 	}
 
-	if (u.eeprom.header.data_version == 1 && u.eeprom.header.data_length < sizeof(u.eeprom.data_v1)) {
-		error("EEPROM header has invalid data-length: %u (actual) < %u (expected)", u.eeprom.header.data_length, sizeof(u.eeprom.data_v1));
+	if (!parse_size(size_string, &size) || size < 1024 * 1024) {
+		error("invalid zram swap size %s, skipping zram setup", size_string);
 
 		return;
 	}
 
-	if (u.eeprom.data_v1.uid[sizeof(u.eeprom.data_v1.uid) - 1] != '\0') {
-		error("EEPROM data UID is not null-terminated");
-
+	if (!modprobe("zram", false)) {
 		return;
 	}
 
-	if (u.eeprom.data_v1.hostname[sizeof(u.eeprom.data_v1.hostname) - 1] != '\0') {
-		error("EEPROM data hostname is not null-terminated");
+	if (algorithm != NULL && !write_sysfs("/sys/block/zram0/comp_algorithm", algorithm)) {
+		error("zram compression algorithm %s is not supported, using kernel default", algorithm);
+	}
+
+	snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)size);
+
+	if (!write_sysfs("/sys/block/zram0/disksize", buffer)) {
+		error("could not set zram disk size, skipping zram setup");
 
 		return;
 	}
 
-	if (u.eeprom.data_v1.encrypted_password[sizeof(u.eeprom.data_v1.encrypted_password) - 1] != '\0') {
-		error("EEPROM data encrypted-password is not null-terminated");
+	format_swap("/dev/zram0", size);
+
+	if (swapon("/dev/zram0", SWAP_FLAG_PREFER | (ZRAM_SWAP_PRIORITY << SWAP_FLAG_PRIO_SHIFT) | SWAP_FLAG_DISCARD) < 0) {
+		error("could not enable zram swap: %s (%d)", strerror(errno), errno);
 
 		return;
 	}
 
-	memcpy(&eeprom, &u.eeprom, sizeof(eeprom));
+	// the active algorithm is shown in brackets
+	if (!read_sysfs("/sys/block/zram0/comp_algorithm", algorithms, sizeof(algorithms))) {
+		snprintf(algorithms, sizeof(algorithms), "<unknown>");
+	}
 
-	eeprom_valid = true;
+	print("enabled %llu MiB zram swap with priority %d, compression algorithms: %s",
+	      (unsigned long long)(size >> 20), ZRAM_SWAP_PRIORITY, algorithms);
 }
 
-static void replace_password(void)
+// parse a CPU list like 0-1,3 into a bitmask
+static bool parse_cpu_list(const char *value, uint32_t *mask)
+{
+	const char *p = value;
+	char *end;
+	unsigned long first;
+	unsigned long last;
+
+	*mask = 0;
+
+	while (*p != '\0') {
+		if (*p < '0' || *p > '9') {
+			return false;
+		}
+
+		first = strtoul(p, &end, 10);
+		last = first;
+
+		if (*end == '-') {
+			p = end + 1;
+
+			if (*p < '0' || *p > '9') {
+				return false;
+			}
+
+			last = strtoul(p, &end, 10);
+		}
+
+		if (first > last || last >= 32) {
+			return false;
+		}
+
+		for (; first <= last; ++first) {
+			*mask |= 1u << first;
+		}
+
+		if (*end == ',') {
+			++end;
+		} else if (*end != '\0') {
+			return false;
+		}
+
+		p = end;
+	}
+
+	return *mask != 0;
+}
+
+static void format_cpu_list(uint32_t mask, char *buffer, size_t buffer_length)
+{
+	size_t offset = 0;
+	int first;
+	int last;
+
+	buffer[0] = '\0';
+
+	for (first = 0; first < 32; first = last + 1) {
+		if ((mask & (1u << first)) == 0) {
+			last = first;
+
+			continue;
+		}
+
+		for (last = first; last < 31 && (mask & (1u << (last + 1))) != 0; ++last);
+
+		if (first == last) {
+			offset += snprintf(buffer + offset, buffer_length - offset, "%s%d", offset > 0 ? "," : "", first);
+		} else {
+			offset += snprintf(buffer + offset, buffer_length - offset, "%s%d-%d", offset > 0 ? "," : "", first, last);
+		}
+
+		if (offset >= buffer_length) {
+			break;
+		}
+	}
+}
+
+// returns false without logging, per CPU and chained interrupts cannot be moved
+static bool set_irq_affinity(unsigned int irq, const char *cpus)
 {
+	char path[64];
 	int fd;
-	struct stat st;
-	char *buffer;
-	size_t buffer_used;
 	ssize_t length;
-	char *entry_begin;
-	char *encrypted_begin;
-	char *encrypted_end;
-	char encrypted[SHADOW_ENCRYPTED_LENGTH];
-	size_t encrypted_used;
-	char salt[SHADOW_ENCRYPTED_LENGTH]; // over-allocate to be safe
-	size_t salt_used;
-	char *encrypted_prefix_end;
-	struct crypt_data crypt_data;
-	const char *crypt_result;
 
-	if (!eeprom_valid || eeprom.header.data_version < 1) {
-		error("required EEPROM data not available, skipping password replacement");
+	snprintf(path, sizeof(path), "/proc/irq/%u/smp_affinity_list", irq);
+
+	fd = open(path, O_WRONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	length = write(fd, cpus, strlen(cpus));
+
+	close(fd);
+
+	return length >= 0;
+}
+
+// the dwc_otg interrupt actions as listed in the last column of /proc/interrupts
+static const char *const usb_irq_actions[] = {"dwc_otg", "dwc_otg_pcd", "dwc_otg_hcd:usb1"};
+
+// returns the USB action of a /proc/interrupts line, or NULL. the line ends
+// with the comma separated action names, after the per CPU counters and the
+// interrupt controller columns. the line is modified
+static const char *find_usb_irq_action(char *line)
+{
+	char *tokens[64];
+	size_t token_count = 0;
+	char *cursor;
+	char *token;
+	size_t length;
+	size_t i;
+	size_t k;
+
+	for (token = strtok_r(line, " \t", &cursor); token != NULL; token = strtok_r(NULL, " \t", &cursor)) {
+		if (token_count >= sizeof(tokens) / sizeof(tokens[0])) {
+			return NULL;
+		}
+
+		tokens[token_count++] = token;
+	}
+
+	// walk the actions from the end, all but the last one end with a comma
+	for (i = token_count; i > 1; --i) {
+		token = tokens[i - 1];
+		length = strlen(token);
+
+		if (i < token_count) {
+			if (length == 0 || token[length - 1] != ',') {
+				break; // not an action anymore
+			}
+
+			token[--length] = '\0';
+		}
+
+		for (k = 0; k < sizeof(usb_irq_actions) / sizeof(usb_irq_actions[0]); ++k) {
+			if (strcmp(token, usb_irq_actions[k]) == 0) {
+				return usb_irq_actions[k];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// on the CM3 the LAN7500 and all Bricks are behind the dwc_otg controller.
+// its interrupt gets CPUs of its own, all other interrupts and the services
+// (via CPUAffinity= of systemd) get the remaining CPUs. the CPU sets are
+// published in /run/tng-base/cpuset, so services that talk to the Bricks
+// (e.g. brickd) can opt into the USB CPUs. if no USB interrupt can be steered
+// the default affinity is restored and nothing is published
+static void setup_irq_affinity(void)
+{
+	char line[512];
+	static char config_usb[512];
+	const char *usb_string = cmdline.irq_usb;
+	char buffer[64];
+	uint32_t online_mask;
+	uint32_t usb_mask;
+	uint32_t service_mask;
+	uint32_t default_mask;
+	char default_affinity[64];
+	char usb_cpus[64];
+	char service_cpus[64];
+	char default_cpus[64];
+	unsigned int irq;
+	const char *name;
+	size_t usb_count = 0;
+	size_t other_count = 0;
+	FILE *fp;
+	int fd;
+
+	// read config from root, the command line takes precedence
+	fp = fopen(IRQ_CONFIG_PATH, "rb");
+
+	if (fp == NULL) {
+		if (errno != ENOENT) {
+			error("could not open %s for reading: %s (%d)", IRQ_CONFIG_PATH, strerror(errno), errno);
+		}
+	} else {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+
+			if (usb_string == NULL && strncmp(line, "usb=", 4) == 0) {
+				snprintf(config_usb, sizeof(config_usb), "%s", line + 4);
+
+				usb_string = config_usb;
+			}
+		}
+
+		fclose(fp);
+	}
+
+	if (usb_string == NULL) {
+		print("IRQ affinity profile is not configured");
 
 		return;
 	}
 
-	crypt_data.initialized = 0;
+	if (!parse_cpu_list(usb_string, &usb_mask)) {
+		error("invalid USB CPU list %s, skipping IRQ affinity setup", usb_string);
 
-	// open /etc/shadow
-	print("opening %s", SHADOW_PATH);
+		return;
+	}
 
-	fd = open(SHADOW_PATH, O_RDONLY);
+	if (!read_sysfs("/sys/devices/system/cpu/online", buffer, sizeof(buffer)) || !parse_cpu_list(buffer, &online_mask)) {
+		error("could not get online CPUs, skipping IRQ affinity setup");
+
+		return;
+	}
+
+	usb_mask &= online_mask;
+	service_mask = online_mask & ~usb_mask;
+
+	if (usb_mask == 0 || service_mask == 0) {
+		error("USB CPU list %s has to contain some but not all of the online CPUs %s, skipping IRQ affinity setup", usb_string, buffer);
+
+		return;
+	}
+
+	format_cpu_list(usb_mask, usb_cpus, sizeof(usb_cpus));
+	format_cpu_list(service_mask, service_cpus, sizeof(service_cpus));
+
+	// remember the default, it's restored if no USB interrupt can be steered
+	if (!read_sysfs("/proc/irq/default_smp_affinity", default_affinity, sizeof(default_affinity))) {
+		error("could not get default IRQ affinity, skipping IRQ affinity setup");
+
+		return;
+	}
+
+	default_mask = strtoul(default_affinity, NULL, 16) & online_mask;
+
+	format_cpu_list(default_mask != 0 ? default_mask : online_mask, default_cpus, sizeof(default_cpus));
+
+	// interrupts requested later
+	snprintf(buffer, sizeof(buffer), "%x", service_mask);
+
+	write_sysfs("/proc/irq/default_smp_affinity", buffer);
+
+	// interrupts requested so far, one line per interrupt after the CPU header
+	fp = fopen("/proc/interrupts", "rb");
+
+	if (fp == NULL) {
+		error("could not open /proc/interrupts for reading: %s (%d)", strerror(errno), errno);
+
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (sscanf(line, " %u:", &irq) != 1) {
+			continue; // header or IPI, FIQ, Err lines
+		}
+
+		name = find_usb_irq_action(line);
+
+		if (name != NULL) {
+			if (set_irq_affinity(irq, usb_cpus)) {
+				print("steered IRQ %u (%s) to CPU %s", irq, name, usb_cpus);
+
+				++usb_count;
+			} else {
+				error("could not steer IRQ %u (%s) to CPU %s", irq, name, usb_cpus);
+			}
+		} else if (set_irq_affinity(irq, service_cpus)) {
+			++other_count;
+		}
+	}
+
+	if (usb_count == 0) {
+		// the interrupt controller might refuse to move the USB interrupt,
+		// then the profile would only take CPUs away from everything else
+		error("no USB interrupt could be steered, restoring default IRQ affinity %s", default_cpus);
+
+		write_sysfs("/proc/irq/default_smp_affinity", default_affinity);
+
+		rewind(fp);
+
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, " %u:", &irq) == 1) {
+				set_irq_affinity(irq, default_cpus);
+			}
+		}
+
+		fclose(fp);
+
+		return;
+	}
+
+	fclose(fp);
+
+	// publish the CPU sets, /run is moved into the new root
+	fd = create_file(IRQ_CPUSET_PATH, 0, 0, 0444);
+
+	snprintf(line, sizeof(line), "usb=%s\nservices=%s\n", usb_cpus, service_cpus);
+	robust_write(IRQ_CPUSET_PATH, fd, line, strlen(line));
+
+	close(fd);
+
+	if (mkdir("/run/systemd", 0755) < 0 && errno != EEXIST) {
+		error("could not create /run/systemd: %s (%d)", strerror(errno), errno);
+	} else if (mkdir(IRQ_SYSTEMD_CONFIG_DIRECTORY, 0755) < 0 && errno != EEXIST) {
+		error("could not create %s: %s (%d)", IRQ_SYSTEMD_CONFIG_DIRECTORY, strerror(errno), errno);
+	} else {
+		fd = create_file(IRQ_SYSTEMD_CONFIG_PATH, 0, 0, 0444);
+
+		snprintf(line, sizeof(line), "[Manager]\nCPUAffinity=%s\n", service_cpus);
+		robust_write(IRQ_SYSTEMD_CONFIG_PATH, fd, line, strlen(line));
+
+		close(fd);
+	}
+
+	print("IRQ affinity profile: %zu USB interrupts on CPU %s, %zu other interrupts and services on CPU %s",
+	      usb_count, usb_cpus, other_count, service_cpus);
+}
+
+// the LAN7500 and the Bricks stay awake by default, everything else keeps the
+// kernel default power management
+static const UsbPowerRule default_usb_power_rules[] = {
+	{ETHERNET_VENDOR_ID, ETHERNET_PRODUCT_ID, "", 1, -1, USB_POWER_KEEP},
+	{BRICK_VENDOR_ID, BRICK_PRODUCT_ID, "", 1, -1, USB_POWER_KEEP}
+};
+
+// parse a rule line like "0424:7500 control=on autosuspend=-1 lpm=0" or
+// "port:1-1.3 control=on"
+static bool parse_usb_power_rule(char *line, UsbPowerRule *rule)
+{
+	char *cursor;
+	char *token;
+	char *value;
+	char *end;
+	long number;
+
+	memset(rule, 0, sizeof(*rule));
+
+	rule->control = USB_POWER_KEEP;
+	rule->autosuspend_delay = USB_POWER_KEEP;
+	rule->lpm = USB_POWER_KEEP;
+
+	token = strtok_r(line, " \t", &cursor);
+
+	if (token == NULL) {
+		return false;
+	}
+
+	if (strncmp(token, "port:", 5) == 0) {
+		if (token[5] == '\0' || strlen(token + 5) >= sizeof(rule->port)) {
+			return false;
+		}
+
+		snprintf(rule->port, sizeof(rule->port), "%s", token + 5);
+	} else {
+		if (strlen(token) != 9 || token[4] != ':' || strspn(token, "0123456789abcdef:") != 9) {
+			return false;
+		}
+
+		memcpy(rule->vendor_id, token, 4);
+		memcpy(rule->product_id, token + 5, 4);
+	}
+
+	while ((token = strtok_r(NULL, " \t", &cursor)) != NULL) {
+		value = strchr(token, '=');
+
+		if (value == NULL) {
+			return false;
+		}
+
+		*value++ = '\0';
+
+		if (strcmp(token, "control") == 0) {
+			if (strcmp(value, "on") == 0) {
+				rule->control = 1;
+			} else if (strcmp(value, "auto") == 0) {
+				rule->control = 0;
+			} else {
+				return false;
+			}
+
+			continue;
+		}
+
+		number = strtol(value, &end, 10);
+
+		if (*value == '\0' || *end != '\0') {
+			return false;
+		}
+
+		if (strcmp(token, "autosuspend") == 0 && number >= -1 && number <= 86400000) {
+			rule->autosuspend_delay = number;
+		} else if (strcmp(token, "lpm") == 0 && (number == 0 || number == 1)) {
+			rule->lpm = number;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// returns the number of rules, the default rules if there is no config
+static size_t load_usb_power_rules(UsbPowerRule *rules)
+{
+	char line[256];
+	size_t rule_count = 0;
+	FILE *fp;
+
+	fp = fopen(USB_POWER_CONFIG_PATH, "rb");
+
+	if (fp == NULL) {
+		if (errno != ENOENT) {
+			error("could not open %s for reading: %s (%d)", USB_POWER_CONFIG_PATH, strerror(errno), errno);
+		}
+
+		print("using default USB power rules");
+
+		memcpy(rules, default_usb_power_rules, sizeof(default_usb_power_rules));
+
+		return sizeof(default_usb_power_rules) / sizeof(default_usb_power_rules[0]);
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "#\r\n")] = '\0';
+
+		if (line[strspn(line, " \t")] == '\0') {
+			continue;
+		}
+
+		if (rule_count >= USB_POWER_RULE_COUNT) {
+			error("more than %d rules in %s, ignoring the rest", USB_POWER_RULE_COUNT, USB_POWER_CONFIG_PATH);
+
+			break;
+		}
+
+		if (!parse_usb_power_rule(line, &rules[rule_count])) {
+			error("invalid rule in %s, ignoring it", USB_POWER_CONFIG_PATH);
+
+			continue;
+		}
+
+		++rule_count;
+	}
+
+	fclose(fp);
+
+	return rule_count;
+}
+
+static bool match_usb_power_rule(const UsbPowerRule *rule, const char *port, const char *vendor_id, const char *product_id)
+{
+	if (rule->port[0] != '\0') {
+		return strcmp(rule->port, port) == 0;
+	}
+
+	return strcmp(rule->vendor_id, vendor_id) == 0 && strcmp(rule->product_id, product_id) == 0;
+}
+
+// all matching rules apply, for each setting the first rule giving it wins
+static void apply_usb_power_rules(const UsbPowerRule *rules, size_t rule_count, const char *port)
+{
+	char path[PATH_MAX];
+	char vendor_id[8];
+	char product_id[8];
+	char value[32];
+	UsbPowerRule merged;
+	size_t i;
+	bool matched = false;
+
+	snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/idVendor", port);
+
+	if (!read_sysfs(path, vendor_id, sizeof(vendor_id))) {
+		return;
+	}
+
+	snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/idProduct", port);
+
+	if (!read_sysfs(path, product_id, sizeof(product_id))) {
+		return;
+	}
+
+	merged.control = USB_POWER_KEEP;
+	merged.autosuspend_delay = USB_POWER_KEEP;
+	merged.lpm = USB_POWER_KEEP;
+
+	for (i = 0; i < rule_count; ++i) {
+		if (!match_usb_power_rule(&rules[i], port, vendor_id, product_id)) {
+			continue;
+		}
+
+		matched = true;
+
+		if (merged.control == USB_POWER_KEEP) {
+			merged.control = rules[i].control;
+		}
+
+		if (merged.autosuspend_delay == USB_POWER_KEEP) {
+			merged.autosuspend_delay = rules[i].autosuspend_delay;
+		}
+
+		if (merged.lpm == USB_POWER_KEEP) {
+			merged.lpm = rules[i].lpm;
+		}
+	}
+
+	if (!matched) {
+		return;
+	}
+
+	// set the delay before control, so an autosuspend doesn't happen early
+	if (merged.autosuspend_delay != USB_POWER_KEEP) {
+		snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/power/autosuspend_delay_ms", port);
+		snprintf(value, sizeof(value), "%d", merged.autosuspend_delay);
+
+		write_sysfs(path, value);
+	}
+
+	if (merged.control != USB_POWER_KEEP) {
+		snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/power/control", port);
+
+		write_sysfs(path, merged.control ? "on" : "auto");
+	}
+
+	// only present if the device and the host controller support LPM
+	if (merged.lpm != USB_POWER_KEEP) {
+		snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/power/usb2_hardware_lpm", port);
+
+		if (access(path, F_OK) < 0) {
+			print("USB device %s (%s:%s) doesn't support LPM", port, vendor_id, product_id);
+
+			merged.lpm = USB_POWER_KEEP;
+		} else {
+			write_sysfs(path, merged.lpm ? "1" : "0");
+		}
+	}
+
+	if (merged.autosuspend_delay == USB_POWER_KEEP) {
+		snprintf(value, sizeof(value), "kept");
+	} else {
+		snprintf(value, sizeof(value), "%d msec", merged.autosuspend_delay);
+	}
+
+	print("USB device %s (%s:%s): control %s, autosuspend delay %s, LPM %s", port, vendor_id, product_id,
+	      merged.control == USB_POWER_KEEP ? "kept" : (merged.control ? "on" : "auto"), value,
+	      merged.lpm == USB_POWER_KEEP ? "kept" : (merged.lpm ? "on" : "off"));
+}
+
+// the same rules as udev rules for devices showing up after init. udev applies
+// all matching rules with the last one winning, so write them in reverse order
+static void write_usb_power_udev_rules(const UsbPowerRule *rules, size_t rule_count)
+{
+	char match[96];
+	char line[768];
+	int length;
+	size_t i;
+	const UsbPowerRule *rule;
+	int fd;
+
+	if (mkdir("/run/udev", 0755) < 0 && errno != EEXIST) {
+		error("could not create /run/udev: %s (%d)", strerror(errno), errno);
+
+		return;
+	}
+
+	if (mkdir(USB_POWER_UDEV_RULES_DIRECTORY, 0755) < 0 && errno != EEXIST) {
+		error("could not create %s: %s (%d)", USB_POWER_UDEV_RULES_DIRECTORY, strerror(errno), errno);
+
+		return;
+	}
+
+	fd = create_file(USB_POWER_UDEV_RULES_PATH, 0, 0, 0444);
+
+	for (i = rule_count; i > 0; --i) {
+		rule = &rules[i - 1];
+
+		if (rule->port[0] != '\0') {
+			snprintf(match, sizeof(match), "KERNEL==\"%s\"", rule->port);
+		} else {
+			snprintf(match, sizeof(match), "ATTR{idVendor}==\"%s\", ATTR{idProduct}==\"%s\"", rule->vendor_id, rule->product_id);
+		}
+
+		length = snprintf(line, sizeof(line), "ACTION==\"add\", SUBSYSTEM==\"usb\", ENV{DEVTYPE}==\"usb_device\", %s", match);
+
+		if (rule->autosuspend_delay != USB_POWER_KEEP) {
+			length += snprintf(line + length, sizeof(line) - length, ", ATTR{power/autosuspend_delay_ms}=\"%d\"", rule->autosuspend_delay);
+		}
+
+		if (rule->control != USB_POWER_KEEP) {
+			length += snprintf(line + length, sizeof(line) - length, ", ATTR{power/control}=\"%s\"", rule->control ? "on" : "auto");
+		}
+
+		// separate rule, TEST would make the other settings depend on LPM support
+		if (rule->lpm != USB_POWER_KEEP) {
+			length += snprintf(line + length, sizeof(line) - length,
+			                   "\nACTION==\"add\", SUBSYSTEM==\"usb\", ENV{DEVTYPE}==\"usb_device\", %s, "
+			                   "TEST==\"power/usb2_hardware_lpm\", ATTR{power/usb2_hardware_lpm}=\"%d\"", match, rule->lpm);
+		}
+
+		snprintf(line + length, sizeof(line) - length, "\n");
+
+		robust_write(USB_POWER_UDEV_RULES_PATH, fd, line, strlen(line));
+	}
+
+	close(fd);
+}
+
+// USB autosuspend adds wake-up latency to the first packet and the first
+// brickd request after idle. the devices present now are handled here, the
+// ones showing up later by udev with the same rules. the caller has to join the
+// Ethernet driver thread first, otherwise the LAN7500 might show up later
+static void setup_usb_power(void)
+{
+	static UsbPowerRule rules[USB_POWER_RULE_COUNT];
+	size_t rule_count;
+	DIR *dp;
+	struct dirent *dirent;
+
+	rule_count = load_usb_power_rules(rules);
+
+	if (rule_count == 0) {
+		print("no USB power rules configured");
+
+		return;
+	}
+
+	dp = opendir("/sys/bus/usb/devices");
+
+	if (dp == NULL) {
+		error("could not open /sys/bus/usb/devices: %s (%d)", strerror(errno), errno);
+	} else {
+		while ((dirent = readdir(dp)) != NULL) {
+			// skip interfaces (<port>:<config>.<interface>) and . and ..
+			if (dirent->d_name[0] == '.' || strchr(dirent->d_name, ':') != NULL) {
+				continue;
+			}
+
+			apply_usb_power_rules(rules, rule_count, dirent->d_name);
+		}
+
+		closedir(dp);
+	}
+
+	write_usb_power_udev_rules(rules, rule_count);
+}
+
+typedef struct {
+	size_t file_count;
+	uint64_t byte_count;
+	uint8_t buffer[VARLOG_COPY_LENGTH];
+} TreeCopy;
+
+static bool copy_metadata(const char *path, int fd, const struct stat *st)
+{
+	struct timespec times[2];
+
+	if (fchown(fd, st->st_uid, st->st_gid) < 0 || fchmod(fd, st->st_mode & 07777) < 0) {
+		error("could not copy owner and mode to %s: %s (%d)", path, strerror(errno), errno);
+
+		return false;
+	}
+
+	times[0] = st->st_atim;
+	times[1] = st->st_mtim;
+
+	if (futimens(fd, times) < 0) {
+		error("could not copy timestamps to %s: %s (%d)", path, strerror(errno), errno);
+
+		return false;
+	}
+
+	return true;
+}
+
+// recursively copy directory src_fd into dst_fd with owner, mode and
+// timestamps. errors are not fatal here, because the caller can fall back to
+// the original directory
+static bool copy_tree(int src_fd, int dst_fd, const char *path, TreeCopy *copy)
+{
+	DIR *dp;
+	struct dirent *dirent;
+	struct stat st;
+	int src_child_fd;
+	int dst_child_fd;
+	char child_path[PATH_MAX];
+	char target[PATH_MAX];
+	ssize_t length;
+	bool success = true;
+
+	dp = fdopendir(src_fd);
+
+	if (dp == NULL) {
+		error("could not open directory %s: %s (%d)", path, strerror(errno), errno);
+		close(src_fd);
+
+		return false;
+	}
+
+	while (success && (dirent = readdir(dp)) != NULL) {
+		if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+			continue;
+		}
+
+		// carry the full path through the recursion for the error messages
+		if ((size_t)snprintf(child_path, sizeof(child_path), "%s/%s", path, dirent->d_name) >= sizeof(child_path)) {
+			error("path of %s/%s is too long", path, dirent->d_name);
+
+			success = false;
+			continue;
+		}
+
+		if (fstatat(dirfd(dp), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			error("could not get status of %s: %s (%d)", child_path, strerror(errno), errno);
+
+			success = false;
+		} else if (S_ISDIR(st.st_mode)) {
+			if (mkdirat(dst_fd, dirent->d_name, 0700) < 0) {
+				error("could not create %s: %s (%d)", child_path, strerror(errno), errno);
+
+				success = false;
+				continue;
+			}
+
+			src_child_fd = openat(dirfd(dp), dirent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+			dst_child_fd = openat(dst_fd, dirent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+
+			if (src_child_fd < 0 || dst_child_fd < 0) {
+				error("could not open directory %s: %s (%d)", child_path, strerror(errno), errno);
+
+				success = false;
+			} else {
+				success = copy_tree(src_child_fd, dst_child_fd, child_path, copy) &&
+				          copy_metadata(child_path, dst_child_fd, &st);
+				src_child_fd = -1; // closed by copy_tree
+			}
+
+			if (src_child_fd >= 0) {
+				close(src_child_fd);
+			}
+
+			if (dst_child_fd >= 0) {
+				close(dst_child_fd);
+			}
+		} else if (S_ISLNK(st.st_mode)) {
+			length = readlinkat(dirfd(dp), dirent->d_name, target, sizeof(target));
+
+			if (length < 0) {
+				error("could not read symlink %s: %s (%d)", child_path, strerror(errno), errno);
+
+				success = false;
+				continue;
+			}
+
+			// readlinkat truncates silently, a full buffer might be truncated
+			if ((size_t)length >= sizeof(target)) {
+				error("target of symlink %s is too long", child_path);
+
+				success = false;
+				continue;
+			}
+
+			target[length] = '\0';
+
+			if (symlinkat(target, dst_fd, dirent->d_name) < 0 ||
+			    fchownat(dst_fd, dirent->d_name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) < 0) {
+				error("could not create symlink %s: %s (%d)", child_path, strerror(errno), errno);
+
+				success = false;
+			}
+		} else if (S_ISREG(st.st_mode)) {
+			src_child_fd = openat(dirfd(dp), dirent->d_name, O_RDONLY | O_NOFOLLOW);
+			dst_child_fd = openat(dst_fd, dirent->d_name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+
+			if (src_child_fd < 0 || dst_child_fd < 0) {
+				error("could not open %s: %s (%d)", child_path, strerror(errno), errno);
+
+				success = false;
+			} else {
+				while ((length = read(src_child_fd, copy->buffer, sizeof(copy->buffer))) > 0) {
+					if (write(dst_child_fd, copy->buffer, length) != length) {
+						break;
+					}
+
+					copy->byte_count += length;
+				}
+
+				if (length != 0) {
+					error("could not copy %s: %s (%d)", child_path, strerror(errno), errno);
+
+					success = false;
+				} else {
+					success = copy_metadata(child_path, dst_child_fd, &st);
+				}
+
+				++copy->file_count;
+			}
+
+			if (src_child_fd >= 0) {
+				close(src_child_fd);
+			}
+
+			if (dst_child_fd >= 0) {
+				close(dst_child_fd);
+			}
+		} // other file types, e.g. sockets, are not copied
+	}
+
+	closedir(dp);
+
+	return success;
+}
+
+// put /var/log on a size-bounded tmpfs seeded from the persistent copy, so
+// logging doesn't cause small synchronous writes to the SD card. the
+// persistent copy stays accessible at /var/log.persistent and is written back
+// by tng-base-varlog-flush on a schedule and at shutdown
+static void setup_varlog(void)
+{
+	uint64_t size;
+	char options[64];
+	int src_fd;
+	int dst_fd;
+	struct stat st;
+	static TreeCopy copy;
+	bool success;
+	uint64_t start = milliseconds();
+
+	if (cmdline.varlog_size == NULL) {
+		print("RAM-backed /var/log is not configured");
+
+		return;
+	}
+
+	if (!parse_size(cmdline.varlog_size, &size) || size < 1024 * 1024) {
+		error("invalid RAM-backed /var/log size %s, keeping /var/log on disk", cmdline.varlog_size);
+
+		return;
+	}
+
+	if (mkdir(VARLOG_PERSISTENT_PATH, 0755) < 0 && errno != EEXIST) {
+		error("could not create %s: %s (%d)", VARLOG_PERSISTENT_PATH, strerror(errno), errno);
+
+		return;
+	}
+
+	if (mount(VARLOG_PATH, VARLOG_PERSISTENT_PATH, NULL, MS_BIND, NULL) < 0) {
+		error("could not bind-mount %s at %s: %s (%d)", VARLOG_PATH, VARLOG_PERSISTENT_PATH, strerror(errno), errno);
+
+		return;
+	}
+
+	snprintf(options, sizeof(options), "mode=0755,size=%llu", (unsigned long long)size);
+
+	if (mount("tmpfs", VARLOG_PATH, "tmpfs", MS_NOSUID | MS_NODEV | MS_NOEXEC, options) < 0) {
+		error("could not mount tmpfs at %s: %s (%d)", VARLOG_PATH, strerror(errno), errno);
+		umount2(VARLOG_PERSISTENT_PATH, MNT_DETACH);
+
+		return;
+	}
+
+	src_fd = open(VARLOG_PERSISTENT_PATH, O_RDONLY | O_DIRECTORY);
+	dst_fd = open(VARLOG_PATH, O_RDONLY | O_DIRECTORY);
+
+	if (src_fd < 0 || dst_fd < 0 || fstat(src_fd, &st) < 0 || !copy_metadata(VARLOG_PATH, dst_fd, &st)) {
+		success = false;
+
+		if (src_fd >= 0) {
+			close(src_fd);
+		}
+	} else {
+		success = copy_tree(src_fd, dst_fd, VARLOG_PERSISTENT_PATH, &copy); // closes src_fd
+	}
+
+	if (dst_fd >= 0) {
+		close(dst_fd);
+	}
+
+	if (!success) {
+		error("could not seed RAM-backed /var/log, keeping /var/log on disk");
+
+		umount2(VARLOG_PATH, MNT_DETACH);
+		umount2(VARLOG_PERSISTENT_PATH, MNT_DETACH);
+
+		return;
+	}
+
+	print("seeded %llu MiB RAM-backed /var/log with %zu files (%llu kB) in %llu msec",
+	      (unsigned long long)(size >> 20), copy.file_count, (unsigned long long)(copy.byte_count >> 10),
+	      (unsigned long long)(milliseconds() - start));
+}
+
+static void rtc_hctosys(void)
+{
+	int fd;
+	struct tm hc_start;
+	struct tm hc_now;
+	time_t timeout_start;
+	time_t timeout_now;
+	struct timeval sys_now;
+	struct tm sys_now_local;
+	int minuteswest;
+	struct timezone tz;
+
+	// read RTC time
+	fd = open(RTC_PATH, O_RDONLY);
+
+	if (fd < 0) {
+		error("could not open %s for reading: %s (%d)", RTC_PATH, strerror(errno), errno);
+
+		return;
+	}
+
+	if (ioctl(fd, RTC_RD_TIME, &hc_start) < 0) {
+		error("could not read RTC time: %s (%d)", strerror(errno), errno);
+		close(fd);
+
+		return;
+	}
+
+	timeout_start = time(NULL);
+
+	while (true) {
+		if (ioctl(fd, RTC_RD_TIME, &hc_now) < 0) {
+			error("could not read RTC time: %s (%d)", strerror(errno), errno);
+			close(fd);
+
+			return;
+		}
+
+		if (hc_start.tm_sec != hc_now.tm_sec) {
+			break;
+		}
+
+		timeout_now = time(NULL);
+
+		if (timeout_now - timeout_start > 3) {
+			error("RTC time seems to be stuck, cannot set system time");
+			close(fd);
+
+			return;
+		}
+	}
+
+	hc_now.tm_isdst = -1; // daylight saving time is undefined
+
+	close(fd);
+
+	// set system time
+	sys_now.tv_sec = timegm(&hc_now);
+	sys_now.tv_usec = 0;
+
+	if (sys_now.tv_sec < 0) {
+		error("could not convert RTC time %d-%02d-%02d %02d:%02d:%02d UTC to system time: %s (%d)",
+		      hc_now.tm_year + 1900, hc_now.tm_mon + 1, hc_now.tm_mday,
+		      hc_now.tm_hour, hc_now.tm_min, hc_now.tm_sec, strerror(errno), errno);
+
+		return;
+	}
+
+	localtime_r(&sys_now.tv_sec, &sys_now_local);
+
+	minuteswest = timezone / 60;
+
+	if (sys_now_local.tm_isdst) {
+		minuteswest -= 60;
+	}
+
+	tz.tz_minuteswest = minuteswest;
+	tz.tz_dsttime = 0;
+
+	if (settimeofday(&sys_now, &tz) < 0) {
+		error("could not use RTC time %d-%02d-%02d %02d:%02d:%02d UTC as system time %d-%02d-%02d %02d:%02d:%02d %+03d:%02d: %s (%d)",
+		      hc_now.tm_year + 1900, hc_now.tm_mon + 1, hc_now.tm_mday,
+		      hc_now.tm_hour, hc_now.tm_min, hc_now.tm_sec,
+		      sys_now_local.tm_year + 1900, sys_now_local.tm_mon + 1, sys_now_local.tm_mday,
+		      sys_now_local.tm_hour, sys_now_local.tm_min, sys_now_local.tm_sec,
+		      -minuteswest / 60, abs(minuteswest) % 60,
+		      strerror(errno), errno);
+
+		return;
+	}
+
+	print("using RTC time %d-%02d-%02d %02d:%02d:%02d UTC as system time %d-%02d-%02d %02d:%02d:%02d %+03d:%02d",
+	      hc_now.tm_year + 1900, hc_now.tm_mon + 1, hc_now.tm_mday,
+	      hc_now.tm_hour, hc_now.tm_min, hc_now.tm_sec,
+	      sys_now_local.tm_year + 1900, sys_now_local.tm_mon + 1, sys_now_local.tm_mday,
+	      sys_now_local.tm_hour, sys_now_local.tm_min, sys_now_local.tm_sec,
+	      -minuteswest / 60, abs(minuteswest) % 60);
+}
+
+static void read_eeprom(void)
+{
+	int fd;
+	uint8_t *blob = eeprom_blob;
+	EEPROM_Header header;
+	char message[256];
+
+	eeprom_valid = false;
+
+	// open I2C bus
+	print("opening %s", EEPROM_PATH);
+
+	fd = open(EEPROM_PATH, O_RDWR);
+
+	if (fd < 0) {
+		error("could not open %s: %s (%d)", EEPROM_PATH, strerror(errno), errno);
+
+		return;
+	}
+
+	// read header
+	print("reading EEPROM header");
+
+	if (eeprom_read(fd, 0, blob, sizeof(header)) < 0) {
+		error("could not read EEPROM header: %s (%d)", strerror(errno), errno);
+		print("closing %s", EEPROM_PATH);
+		close(fd);
+
+		return;
+	}
+
+	memcpy(&header, blob, sizeof(header));
+
+	if (!eeprom_check_header(&header, message, sizeof(message))) {
+		error("%s", message);
+		print("closing %s", EEPROM_PATH);
+		close(fd);
+
+		return;
+	}
+
+	// read data
+	print("reading EEPROM data");
+
+	if (eeprom_read(fd, sizeof(header), blob + sizeof(header), header.data_length) < 0) {
+		error("could not read EEPROM data: %s (%d)", strerror(errno), errno);
+		print("closing %s", EEPROM_PATH);
+		close(fd);
+
+		return;
+	}
+
+	print("closing %s", EEPROM_PATH);
+
+	close(fd);
+
+	// check header and data
+	if (!eeprom_parse(blob, sizeof(header) + header.data_length, &eeprom, message, sizeof(message))) {
+		error("%s", message);
+
+		return;
+	}
+
+	eeprom_valid = true;
+	eeprom_blob_length = sizeof(header) + header.data_length;
+}
+
+// hand the validated EEPROM content over to userspace via /run
+static void write_eeprom_cache(void)
+{
+	int fd;
+	EEPROM_Record record;
+	int i;
+
+	if (!eeprom_valid) {
+		return;
+	}
+
+	memset(&record, 0, sizeof(record));
+
+	record.magic_number = EEPROM_RECORD_MAGIC_NUMBER;
+	record.record_version = EEPROM_RECORD_VERSION;
+	record.record_length = sizeof(record);
+	record.data_version = eeprom.header.data_version;
+	record.production_date = eeprom.data_v1.production_date;
+
+	memcpy(record.uid, eeprom.data_v1.uid, sizeof(record.uid));
+	memcpy(record.hostname, eeprom.data_v1.hostname, sizeof(record.hostname));
+	memcpy(record.ethernet_config, eeprom.data_v1.ethernet_config, sizeof(record.ethernet_config));
+
+	for (i = 0; eeprom.header.data_version >= 2 && i < EEPROM_ACCOUNT_COUNT; ++i) {
+		memcpy(record.account_names[i], eeprom.data_v2.accounts[i].name, sizeof(record.account_names[i]));
+	}
+
+	// tmpfs, no need for temporary files and syncing
+	fd = create_file(EEPROM_CACHE_BLOB_PATH, 0, 0, 0400);
+
+	robust_write(EEPROM_CACHE_BLOB_PATH, fd, eeprom_blob, eeprom_blob_length);
+
+	close(fd);
+
+	fd = create_file(EEPROM_CACHE_RECORD_PATH, 0, 0, 0444);
+
+	robust_write(EEPROM_CACHE_RECORD_PATH, fd, &record, sizeof(record));
+
+	close(fd);
+}
+
+static void format_password_verdict(PasswordVerdict *verdict, const struct stat *st, uint32_t entry_checksum)
+{
+	memset(verdict, 0, sizeof(*verdict));
+
+	verdict->magic_number = PASSWORD_VERDICT_MAGIC_NUMBER;
+	verdict->device = password_verdict_device != 0 ? password_verdict_device : st->st_dev;
+	verdict->inode = st->st_ino;
+	verdict->size = st->st_size;
+	verdict->mtime_sec = st->st_mtim.tv_sec;
+	verdict->mtime_nsec = st->st_mtim.tv_nsec;
+	verdict->entry_checksum = entry_checksum;
+}
+
+static size_t load_password_verdicts(PasswordVerdict *verdicts)
+{
+	int fd;
+	ssize_t length;
+
+	fd = open(PASSWORD_VERDICT_PATH, O_RDONLY);
+
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			error("could not open %s for reading: %s (%d)", PASSWORD_VERDICT_PATH, strerror(errno), errno);
+		}
+
+		return 0;
+	}
+
+	length = read(fd, verdicts, sizeof(PasswordVerdict) * PASSWORD_REPLACEMENT_COUNT);
+
+	close(fd);
+
+	if (length < 0) {
+		error("could not read from %s: %s (%d)", PASSWORD_VERDICT_PATH, strerror(errno), errno);
+
+		return 0;
+	}
+
+	return length / sizeof(PasswordVerdict);
+}
+
+static void store_password_verdicts(const PasswordVerdict *verdicts, size_t verdict_count)
+{
+	int fd;
+
+	fd = create_file(PASSWORD_VERDICT_PATH".tmp", 0, 0, 0600);
+
+	robust_write(PASSWORD_VERDICT_PATH".tmp", fd, verdicts, sizeof(PasswordVerdict) * verdict_count);
+
+	close(fd);
+
+	stage_rename(PASSWORD_VERDICT_PATH".tmp", PASSWORD_VERDICT_PATH);
+}
+
+// copy a byte range between files inside the kernel. copy_file_range shares
+// extents (reflink) where the filesystem supports it. falls back to a fixed
+// size userspace window if the kernel cannot copy between these files
+static void copy_range(const char *src_path, int src_fd, off_t offset, size_t length, const char *dst_path, int dst_fd)
+{
+	ssize_t copied;
+	char window[SHADOW_WINDOW_LENGTH];
+	size_t window_used;
+	bool fallback = false;
+
+	while (length > 0) {
+		if (!fallback) {
+			copied = copy_file_range(src_fd, &offset, dst_fd, NULL, length, 0);
+
+			if (copied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+				fallback = true;
+
+				continue;
+			}
+
+			if (copied < 0) {
+				panic("could not copy from %s to %s: %s (%d)", src_path, dst_path, strerror(errno), errno);
+			}
+		} else {
+			window_used = length < sizeof(window) ? length : sizeof(window);
+			copied = pread(src_fd, window, window_used, offset);
+
+			if (copied < 0) {
+				panic("could not read from %s: %s (%d)", src_path, strerror(errno), errno);
+			}
+
+			if (copied > 0) {
+				robust_write(dst_path, dst_fd, window, copied);
+			}
+
+			offset += copied;
+		}
+
+		if (copied == 0) {
+			panic("short copy from %s to %s", src_path, dst_path);
+		}
+
+		length -= copied;
+	}
+}
+
+// find the offsets of the lines starting with "<account>:" for all accounts in
+// a single scan through a fixed size window
+static void find_entries(const char *path, int fd, PasswordReplacement *replacements, size_t replacement_count)
+{
+	char window[SHADOW_WINDOW_LENGTH];
+	ssize_t length;
+	ssize_t i;
+	size_t k;
+	off_t offset = 0;
+	off_t line_offset = 0;
+	char name[SHADOW_ACCOUNT_LENGTH + 1];
+	size_t name_used = 0;
+	bool collecting = true; // still collecting the account name of the current line
+
+	for (k = 0; k < replacement_count; ++k) {
+		replacements[k].entry_offset = -1;
+	}
+
+	while (true) {
+		length = read(fd, window, sizeof(window));
+
+		if (length < 0) {
+			panic("could not read from %s: %s (%d)", path, strerror(errno), errno);
+		}
+
+		if (length == 0) {
+			return;
+		}
+
+		for (i = 0; i < length; ++i) {
+			if (window[i] == '\n') {
+				line_offset = offset + i + 1;
+				name_used = 0;
+				collecting = true;
+			} else if (collecting) {
+				if (window[i] == ':') {
+					name[name_used] = '\0';
+					collecting = false;
+
+					for (k = 0; k < replacement_count; ++k) {
+						if (replacements[k].entry_offset < 0 && strcmp(replacements[k].account, name) == 0) {
+							replacements[k].entry_offset = line_offset;
+						}
+					}
+				} else if (name_used < SHADOW_ACCOUNT_LENGTH) {
+					name[name_used++] = window[i];
+				} else {
+					collecting = false;
+				}
+			}
+		}
+
+		offset += length;
+	}
+}
+
+// read and parse the entry of the account, returns true if the entry is locked
+// and could have the default password set
+static bool read_entry(const char *path, int fd, const struct stat *st, PasswordReplacement *replacement)
+{
+	ssize_t length;
+	char *entry_end;
+	char *encrypted_begin;
+	char *encrypted_end;
+	size_t encrypted_used;
+	char *encrypted_prefix_end;
+	size_t salt_used;
+
+	if (replacement->entry_offset < 0) {
+		print("account %s is not present, skipping password replacement", replacement->account);
+
+		return false;
+	}
+
+	length = pread(fd, replacement->entry, SHADOW_ENTRY_LENGTH, replacement->entry_offset);
+
+	if (length < 0) {
+		panic("could not read from %s: %s (%d)", path, strerror(errno), errno);
+	}
+
+	replacement->entry[length] = '\0';
+	entry_end = memchr(replacement->entry, '\n', length);
+
+	if (entry_end == NULL) {
+		if (replacement->entry_offset + length < st->st_size) {
+			panic("entry for account %s is too big", replacement->account);
+		}
+
+		entry_end = replacement->entry + length;
+	}
+
+	*entry_end = '\0';
+	replacement->entry_length = entry_end - replacement->entry;
+
+	// find encrypted section in entry
+	encrypted_begin = strchr(replacement->entry, ':');
+
+	if (encrypted_begin == NULL) {
+		panic("encrypted section for account %s is malformed", replacement->account);
+	}
+
+	++encrypted_begin; // skip colon
+
+	encrypted_end = strchr(encrypted_begin, ':');
+
+	if (encrypted_end == NULL) {
+		panic("encrypted section for account %s is malformed", replacement->account);
+	}
+
+	replacement->encrypted_begin = encrypted_begin - replacement->entry;
+	replacement->encrypted_end = encrypted_end - replacement->entry;
+	replacement->entry_checksum = crc32(crc32(0, Z_NULL, 0), (uint8_t *)replacement->entry, replacement->entry_length);
+
+	if (encrypted_begin[0] == '*') {
+		print("account %s has no password set, skipping password replacement", replacement->account);
+
+		return false;
+	}
+
+	if (encrypted_begin[0] != '!') {
+		print("account %s is not locked, skipping password replacement", replacement->account);
+
+		return false;
+	}
+
+	// a locked account can also be locked out completely (!, !! or !*)
+	if (encrypted_end - encrypted_begin == 1 || encrypted_begin[1] == '!' || encrypted_begin[1] == '*') {
+		print("account %s is locked without password, skipping password replacement", replacement->account);
+
+		return false;
+	}
+
+	encrypted_used = encrypted_end - (encrypted_begin + 1); // +1 to skip exclamation mark
+
+	if (encrypted_used >= SHADOW_ENCRYPTED_LENGTH) {
+		panic("encrypted section for account %s is too big", replacement->account);
+	}
+
+	memcpy(replacement->encrypted, encrypted_begin + 1, encrypted_used); // +1 to skip exclamation mark
+
+	replacement->encrypted[encrypted_used] = '\0';
+
+	// get salt from encrypted section
+	if (encrypted_used < 2) {
+		panic("encrypted section for account %s is malformed", replacement->account);
+	}
+
+	if (replacement->encrypted[0] != '$') {
+		salt_used = 2;
+	} else {
+		encrypted_prefix_end = strrchr(replacement->encrypted, '$');
+
+		if (encrypted_prefix_end == NULL) {
+			panic("encrypted section for account %s is malformed", replacement->account);
+		}
+
+		salt_used = encrypted_prefix_end - replacement->encrypted;
+	}
+
+	memcpy(replacement->salt, replacement->encrypted, salt_used);
+
+	replacement->salt[salt_used] = '\0';
+
+	return true;
+}
+
+static void *check_default_password(void *opaque)
+{
+	PasswordReplacement *replacement = opaque;
+	struct crypt_data *crypt_data;
+	const char *crypt_result;
+
+	// struct crypt_data is too big for a thread stack on some libcs
+	crypt_data = calloc(1, sizeof(*crypt_data));
+
+	if (crypt_data == NULL) {
+		panic("could not allocate memory");
+	}
+
+	// encrypt default password with salt from encrypted section
+	crypt_result = crypt_r(replacement->default_password, replacement->salt, crypt_data);
+
+	if (crypt_result == NULL) {
+		panic("could not encrypt default password for account %s: %s (%d)", replacement->account, strerror(errno), errno);
+	}
+
+	replacement->not_default = strcmp(crypt_result, replacement->encrypted) != 0;
+
+	free(crypt_data);
+
+	return NULL;
+}
+
+static void replace_password(void)
+{
+	PasswordReplacement *replacements;
+	size_t replacement_count = 0;
+	PasswordReplacement *replacement;
+	int fd;
+	int backup_fd;
+	int tmp_fd;
+	struct stat st;
+	int i;
+	size_t k;
+	size_t m;
+	PasswordVerdict verdict;
+	PasswordVerdict verdicts[PASSWORD_REPLACEMENT_COUNT];
+	size_t verdict_count;
+	size_t check_count = 0;
+	size_t replace_count = 0;
+	PasswordReplacement *ordered[PASSWORD_REPLACEMENT_COUNT];
+	off_t copy_offset;
+	off_t replace_offset;
+	int rc;
+
+	if (!eeprom_valid || eeprom.header.data_version < 1) {
+		error("required EEPROM data not available, skipping password replacement");
+
+		return;
+	}
+
+	// collect replacements, the tng account is always present, additional
+	// accounts come from the EEPROM data version 2
+	replacements = calloc(PASSWORD_REPLACEMENT_COUNT, sizeof(PasswordReplacement));
+
+	if (replacements == NULL) {
+		panic("could not allocate memory");
+	}
+
+	// a malformed entry only skips its own account, the rest of the EEPROM
+	// data stays usable
+	if (eeprom_check_encrypted_password(eeprom.data_v1.encrypted_password, false)) {
+		replacements[replacement_count].account = ACCOUNT_NAME;
+		replacements[replacement_count].default_password = DEFAULT_PASSWORD;
+		replacements[replacement_count++].replacement = eeprom.data_v1.encrypted_password;
+	} else {
+		error("encrypted-password for account %s is empty or malformed, skipping it", ACCOUNT_NAME);
+	}
+
+	for (i = 0; eeprom.header.data_version >= 2 && i < EEPROM_ACCOUNT_COUNT; ++i) {
+		if (eeprom.data_v2.accounts[i].name[0] == '\0') {
+			continue;
+		}
+
+		for (k = 0; k < replacement_count; ++k) {
+			if (strcmp(replacements[k].account, eeprom.data_v2.accounts[i].name) == 0) {
+				break;
+			}
+		}
+
+		if (k < replacement_count || strcmp(eeprom.data_v2.accounts[i].name, ACCOUNT_NAME) == 0) {
+			error("account %s is listed more than once, ignoring duplicate", eeprom.data_v2.accounts[i].name);
+
+			continue;
+		}
+
+		if (!eeprom_check_encrypted_password(eeprom.data_v2.accounts[i].encrypted_password, true)) {
+			error("encrypted-password for account %s is empty or malformed, skipping it", eeprom.data_v2.accounts[i].name);
+
+			continue;
+		}
+
+		replacements[replacement_count].account = eeprom.data_v2.accounts[i].name;
+		replacements[replacement_count].default_password = eeprom.data_v2.accounts[i].default_password;
+		replacements[replacement_count++].replacement = eeprom.data_v2.accounts[i].encrypted_password;
+	}
+
+	if (replacement_count == 0) {
+		free(replacements);
+
+		return;
+	}
+
+	// open /etc/shadow
+	print("opening %s", SHADOW_PATH);
+
+	fd = open(SHADOW_PATH, O_RDONLY);
+
+	if (fd < 0) {
+		panic("could not open %s for reading: %s (%d)", SHADOW_PATH, strerror(errno), errno);
+	}
+
+	if (fstat(fd, &st) < 0) {
+		panic("could not get status of %s: %s (%d)", SHADOW_PATH, strerror(errno), errno);
+	}
+
+	// find entries for all accounts
+	print("reading %s", SHADOW_PATH);
+
+	find_entries(SHADOW_PATH, fd, replacements, replacement_count);
+
+	if (cmdline.force) {
+		print("ignoring %s (tng.force)", PASSWORD_VERDICT_PATH);
+
+		verdict_count = 0;
+	} else {
+		verdict_count = load_password_verdicts(verdicts);
+	}
+
+	for (k = 0; k < replacement_count; ++k) {
+		replacement = &replacements[k];
+
+		if (!read_entry(SHADOW_PATH, fd, &st, replacement)) {
+			continue;
+		}
+
+		// skip the expensive crypt if this exact entry was already checked before
+		format_password_verdict(&verdict, &st, replacement->entry_checksum);
+
+		for (m = 0; m < verdict_count; ++m) {
+			if (memcmp(&verdicts[m], &verdict, sizeof(verdict)) == 0) {
+				break;
+			}
+		}
+
+		if (m < verdict_count) {
+			print("account %s is known to not have the default password set, skipping password replacement", replacement->account);
+
+			replacement->not_default = true;
+		} else {
+			replacement->check = true;
+			++check_count;
+		}
+	}
+
+	// check default passwords, in parallel if there is more than one
+	for (k = 0; check_count > 1 && k < replacement_count; ++k) {
+		if (replacements[k].check) {
+			rc = pthread_create(&replacements[k].thread, NULL, check_default_password, &replacements[k]);
+
+			if (rc != 0) {
+				panic("could not create thread: %s (%d)", strerror(rc), rc);
+			}
+		}
+	}
+
+	for (k = 0; k < replacement_count; ++k) {
+		replacement = &replacements[k];
+
+		if (!replacement->check) {
+			continue;
+		}
+
+		if (check_count > 1) {
+			pthread_join(replacement->thread, NULL);
+		} else {
+			check_default_password(replacement);
+		}
+
+		if (replacement->not_default) {
+			print("account %s does not have the default password set, skipping password replacement", replacement->account);
+		} else {
+			print("account %s has default password set, replacing with device specific password", replacement->account);
+
+			replacement->replace = true;
+			ordered[replace_count++] = replacement;
+		}
+	}
+
+	if (replace_count > 0) {
+		// order replacements by position in /etc/shadow
+		for (k = 1; k < replace_count; ++k) {
+			for (m = k; m > 0 && ordered[m - 1]->entry_offset > ordered[m]->entry_offset; --m) {
+				replacement = ordered[m];
+				ordered[m] = ordered[m - 1];
+				ordered[m - 1] = replacement;
+			}
+		}
+
+		// create /etc/shadow-
+		backup_fd = create_file(SHADOW_BACKUP_PATH, st.st_uid, st.st_gid, st.st_mode);
+
+		copy_range(SHADOW_PATH, fd, 0, st.st_size, SHADOW_BACKUP_PATH, backup_fd);
+
+		print("closing %s", SHADOW_BACKUP_PATH);
+
+		close(backup_fd);
+
+		// create /etc/shadow+, only the replaced encrypted sections pass through userspace
+		tmp_fd = create_file(SHADOW_TMP_PATH, st.st_uid, st.st_gid, st.st_mode);
+		copy_offset = 0;
+
+		for (k = 0; k < replace_count; ++k) {
+			replacement = ordered[k];
+			replace_offset = replacement->entry_offset + replacement->encrypted_begin;
+
+			copy_range(SHADOW_PATH, fd, copy_offset, replace_offset - copy_offset, SHADOW_TMP_PATH, tmp_fd);
+			robust_write(SHADOW_TMP_PATH, tmp_fd, replacement->replacement, strlen(replacement->replacement));
+
+			copy_offset = replacement->entry_offset + replacement->encrypted_end;
+		}
+
+		copy_range(SHADOW_PATH, fd, copy_offset, st.st_size - copy_offset, SHADOW_TMP_PATH, tmp_fd);
+
+		// the rename keeps the identity of /etc/shadow+, get it for the verdicts
+		if (fstat(tmp_fd, &st) < 0) {
+			panic("could not get status of %s: %s (%d)", SHADOW_TMP_PATH, strerror(errno), errno);
+		}
+
+		print("closing %s", SHADOW_TMP_PATH);
+
+		close(tmp_fd);
+
+		// rename /etc/shadow+ to /etc/shadow
+		stage_rename(SHADOW_TMP_PATH, SHADOW_PATH);
+	}
+
+	// remember all entries that don't have the default password set (anymore)
+	// for the next boot. the verdicts are keyed by the identity of /etc/shadow,
+	// so all of them have to be rewritten if any entry was checked or replaced
+	if (check_count > 0 || replace_count > 0) {
+		verdict_count = 0;
+
+		for (k = 0; k < replacement_count; ++k) {
+			replacement = &replacements[k];
+
+			if (replacement->replace) {
+				replacement->entry_checksum = crc32(0, Z_NULL, 0);
+				replacement->entry_checksum = crc32(replacement->entry_checksum, (uint8_t *)replacement->entry, replacement->encrypted_begin);
+				replacement->entry_checksum = crc32(replacement->entry_checksum, (uint8_t *)replacement->replacement, strlen(replacement->replacement));
+				replacement->entry_checksum = crc32(replacement->entry_checksum, (uint8_t *)replacement->entry + replacement->encrypted_end,
+				                                    replacement->entry_length - replacement->encrypted_end);
+			} else if (!replacement->not_default) {
+				continue;
+			}
+
+			format_password_verdict(&verdicts[verdict_count++], &st, replacement->entry_checksum);
+		}
+
+		store_password_verdicts(verdicts, verdict_count);
+	}
+
+	print("closing %s", SHADOW_PATH);
+
+	close(fd);
+	free(replacements);
+}
+
+// check if the USB device of a network interface has the LAN7500 VID/PID.
+// /sys/class/net/<name>/device is the USB interface, its parent is the USB
+// device with the idVendor and idProduct attributes
+static bool check_ethernet_device(const char *name)
+{
+	static const char *const attributes[2][2] = {
+		{"idVendor", ETHERNET_VENDOR_ID},
+		{"idProduct", ETHERNET_PRODUCT_ID}
+	};
+	char path[256];
+	char buffer[16];
+	int fd;
+	ssize_t length;
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		snprintf(path, sizeof(path), "/sys/class/net/%s/device/../%s", name, attributes[i][0]);
+
+		fd = open(path, O_RDONLY);
+
+		if (fd < 0) {
+			return false; // not an USB device
+		}
+
+		length = read(fd, buffer, sizeof(buffer) - 1);
+
+		close(fd);
+
+		if (length < 0) {
+			return false;
+		}
+
+		buffer[length] = '\0';
+		buffer[strcspn(buffer, "\n")] = '\0';
+
+		if (strcmp(buffer, attributes[i][1]) != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool scan_ethernet_devices(char *name)
+{
+	DIR *dp;
+	struct dirent *dirent;
+	bool found = false;
+
+	dp = opendir("/sys/class/net");
+
+	if (dp == NULL) {
+		panic("could not open /sys/class/net: %s (%d)", strerror(errno), errno);
+	}
+
+	while (!found && (dirent = readdir(dp)) != NULL) {
+		if (dirent->d_name[0] == '.' || strlen(dirent->d_name) >= IFNAMSIZ) {
+			continue;
+		}
+
+		if (check_ethernet_device(dirent->d_name)) {
+			memcpy(name, dirent->d_name, strlen(dirent->d_name) + 1);
+
+			found = true;
+		}
+	}
+
+	closedir(dp);
+
+	return found;
+}
+
+// find the LAN7500 network interface by its USB VID/PID. if it's not there yet
+// then wait for the kernel uevent announcing a new network interface instead
+// of polling sysfs. the uevent socket is opened before the first scan, so an
+// interface showing up between scan and wait is not missed
+static bool find_ethernet_device(char *name)
+{
+	int fd;
+	struct sockaddr_nl addr;
+	uint64_t start = milliseconds();
+	uint64_t elapsed;
+	struct pollfd pfd;
+	static char buffer[4096];
+	ssize_t length;
+	char *p;
+	const char *interface;
+	bool net;
+	bool found = false;
+
+	print("looking up Ethernet device %s:%s", ETHERNET_VENDOR_ID, ETHERNET_PRODUCT_ID);
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+	if (fd < 0) {
+		panic("could not open uevent socket: %s (%d)", strerror(errno), errno);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; // kernel uevents
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		panic("could not bind uevent socket: %s (%d)", strerror(errno), errno);
+	}
+
+	if (scan_ethernet_devices(name)) {
+		print("found Ethernet device name: %s", name);
+		close(fd);
+
+		return true;
+	}
+
+	print("waiting up to %d msec for Ethernet device to show up", ETHERNET_DISCOVERY_TIMEOUT);
+
+	while (!found && (elapsed = milliseconds() - start) < ETHERNET_DISCOVERY_TIMEOUT) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, ETHERNET_DISCOVERY_TIMEOUT - elapsed) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			panic("could not poll uevent socket: %s (%d)", strerror(errno), errno);
+		}
+
+		if ((pfd.revents & POLLIN) == 0) {
+			continue;
+		}
+
+		length = recv(fd, buffer, sizeof(buffer) - 1, 0);
+
+		if (length < 0) {
+			if (errno == ENOBUFS) {
+				// uevents got lost, the interface might have been among them
+				found = scan_ethernet_devices(name);
+
+				continue;
+			}
+
+			panic("could not receive from uevent socket: %s (%d)", strerror(errno), errno);
+		}
+
+		buffer[length] = '\0';
+
+		// the message is "<action>@<devpath>" followed by null-terminated
+		// KEY=VALUE pairs
+		if (strncmp(buffer, "add@", 4) != 0) {
+			continue;
+		}
+
+		interface = NULL;
+		net = false;
+
+		for (p = buffer; p < buffer + length; p += strlen(p) + 1) {
+			if (strcmp(p, "SUBSYSTEM=net") == 0) {
+				net = true;
+			} else if (strncmp(p, "INTERFACE=", 10) == 0) {
+				interface = p + 10;
+			}
+		}
+
+		if (net && interface != NULL && strlen(interface) < IFNAMSIZ && check_ethernet_device(interface)) {
+			memcpy(name, interface, strlen(interface) + 1);
+
+			found = true;
+		}
+	}
+
+	close(fd);
+
+	if (!found) {
+		return false;
+	}
+
+	print("found Ethernet device name after %llu msec: %s", (unsigned long long)(milliseconds() - start), name);
+
+	return true;
+}
+
+static bool scan_ethernet_usb_devices(void)
+{
+	DIR *dp;
+	struct dirent *dirent;
+	char path[PATH_MAX];
+	char vendor_id[8];
+	char product_id[8];
+	bool found = false;
+
+	dp = opendir("/sys/bus/usb/devices");
+
+	if (dp == NULL) {
+		error("could not open /sys/bus/usb/devices: %s (%d)", strerror(errno), errno);
+
+		return false;
+	}
+
+	while (!found && (dirent = readdir(dp)) != NULL) {
+		// skip interfaces (<port>:<config>.<interface>) and . and ..
+		if (dirent->d_name[0] == '.' || strchr(dirent->d_name, ':') != NULL) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/idVendor", dirent->d_name);
+
+		if (!read_sysfs(path, vendor_id, sizeof(vendor_id))) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/idProduct", dirent->d_name);
+
+		if (!read_sysfs(path, product_id, sizeof(product_id))) {
+			continue;
+		}
+
+		found = strcmp(vendor_id, ETHERNET_VENDOR_ID) == 0 && strcmp(product_id, ETHERNET_PRODUCT_ID) == 0;
+	}
+
+	closedir(dp);
+
+	return found;
+}
+
+// wait for the LAN7500 to be enumerated on USB, same uevent logic as for the
+// network interface in find_ethernet_device
+static bool find_ethernet_usb_device(void)
+{
+	int fd;
+	struct sockaddr_nl addr;
+	uint64_t start = milliseconds();
+	uint64_t elapsed;
+	struct pollfd pfd;
+	static char buffer[4096];
+	ssize_t length;
+	char *p;
+	bool found = false;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+	if (fd < 0) {
+		panic("could not open uevent socket: %s (%d)", strerror(errno), errno);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; // kernel uevents
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		panic("could not bind uevent socket: %s (%d)", strerror(errno), errno);
+	}
+
+	found = scan_ethernet_usb_devices();
+
+	while (!found && (elapsed = milliseconds() - start) < ETHERNET_DISCOVERY_TIMEOUT) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, ETHERNET_DISCOVERY_TIMEOUT - elapsed) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			panic("could not poll uevent socket: %s (%d)", strerror(errno), errno);
+		}
+
+		if ((pfd.revents & POLLIN) == 0) {
+			continue;
+		}
+
+		length = recv(fd, buffer, sizeof(buffer) - 1, 0);
+
+		if (length < 0) {
+			if (errno == ENOBUFS) {
+				found = scan_ethernet_usb_devices();
+
+				continue;
+			}
+
+			panic("could not receive from uevent socket: %s (%d)", strerror(errno), errno);
+		}
+
+		buffer[length] = '\0';
+
+		if (strncmp(buffer, "add@", 4) != 0) {
+			continue;
+		}
+
+		for (p = buffer; p < buffer + length; p += strlen(p) + 1) {
+			if (strncmp(p, ETHERNET_UEVENT_PRODUCT, strlen(ETHERNET_UEVENT_PRODUCT)) == 0) {
+				found = true;
+			}
+		}
+	}
+
+	close(fd);
+
+	if (found) {
+		print("found Ethernet USB device %s:%s after %llu msec",
+		      ETHERNET_VENDOR_ID, ETHERNET_PRODUCT_ID, (unsigned long long)(milliseconds() - start));
+	}
+
+	return found;
+}
+
+// the link is only negotiated while the interface is up
+static void bring_up_ethernet_interface(const char *name)
+{
+	int fd;
+	struct ifreq ifr;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+	if (fd < 0) {
+		error("could not open interface control socket: %s (%d)", strerror(errno), errno);
+
+		return;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0) {
+		error("could not get flags of %s: %s (%d)", name, strerror(errno), errno);
+	} else {
+		ifr.ifr_flags |= IFF_UP;
+
+		if (ioctl(fd, SIOCSIFFLAGS, &ifr) < 0) {
+			error("could not bring up %s: %s (%d)", name, strerror(errno), errno);
+		}
+	}
+
+	close(fd);
+}
+
+// runs concurrently to the entropy, rtc, eeprom and password phases. udev
+// would only load the driver late in userspace boot
+static void *load_ethernet_driver(void *opaque)
+{
+	char name[IFNAMSIZ];
+
+	(void)opaque;
+
+	if (!find_ethernet_usb_device()) {
+		error("Ethernet USB device %s:%s not found, not loading %s", ETHERNET_VENDOR_ID, ETHERNET_PRODUCT_ID, ETHERNET_MODULE);
+
+		ethernet_device_missing = true;
+
+		return NULL;
+	}
+
+	// continue if the module is not available, the driver might be built-in
+	modprobe(ETHERNET_MODULE, false);
+
+	ethernet_driver_loaded = milliseconds();
+
+	if (!find_ethernet_device(name)) {
+		error("Ethernet interface didn't show up within %d msec after loading %s", ETHERNET_DISCOVERY_TIMEOUT, ETHERNET_MODULE);
+
+		ethernet_device_missing = true;
+
+		return NULL;
+	}
+
+	print("Ethernet interface %s showed up %llu msec after loading %s",
+	      name, (unsigned long long)(milliseconds() - ethernet_driver_loaded), ETHERNET_MODULE);
+
+	bring_up_ethernet_interface(name);
+
+	memcpy(ethernet_interface, name, sizeof(ethernet_interface));
+
+	return NULL;
+}
+
+static bool has_ethernet_carrier(void)
+{
+	char path[64];
+	char buffer[8];
+	int fd;
+	ssize_t length;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/carrier", ethernet_interface);
+
+	// not read_sysfs, reading fails with EINVAL while the interface is down
+	fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	length = read(fd, buffer, sizeof(buffer));
+
+	close(fd);
+
+	return length > 0 && buffer[0] == '1';
+}
+
+// log the time to carrier. the wait is bounded, so this thread can be joined
+// before switching root without delaying the boot of a unit without a cable
+static void *wait_ethernet_carrier(void *opaque)
+{
+	int fd;
+	struct sockaddr_nl addr;
+	struct pollfd pfd;
+	static char buffer[4096];
+	ssize_t length;
+	struct nlmsghdr *header;
+	struct ifinfomsg *info;
+	unsigned int index = if_nametoindex(ethernet_interface);
+	uint64_t elapsed;
+	bool carrier = false;
+
+	(void)opaque;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+	if (fd < 0) {
+		error("could not open rtnetlink socket: %s (%d)", strerror(errno), errno);
+
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		error("could not bind rtnetlink socket: %s (%d)", strerror(errno), errno);
+		close(fd);
+
+		return NULL;
+	}
+
+	// the socket is bound before the check, so the link event is not missed
+	carrier = has_ethernet_carrier();
+
+	while (!carrier && (elapsed = milliseconds() - ethernet_driver_loaded) < ETHERNET_CARRIER_TIMEOUT) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, ETHERNET_CARRIER_TIMEOUT - elapsed) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			error("could not poll rtnetlink socket: %s (%d)", strerror(errno), errno);
+
+			break;
+		}
+
+		if ((pfd.revents & POLLIN) == 0) {
+			continue;
+		}
+
+		length = recv(fd, buffer, sizeof(buffer), 0);
+
+		if (length < 0) {
+			if (errno == ENOBUFS) {
+				carrier = has_ethernet_carrier();
+
+				continue;
+			}
+
+			error("could not receive from rtnetlink socket: %s (%d)", strerror(errno), errno);
+
+			break;
+		}
+
+		for (header = (struct nlmsghdr *)buffer; NLMSG_OK(header, (size_t)length); header = NLMSG_NEXT(header, length)) {
+			if (header->nlmsg_type != RTM_NEWLINK) {
+				continue;
+			}
+
+			info = NLMSG_DATA(header);
+
+			// IFF_RUNNING is set once the operational state is up, which is the
+			// carrier for this driver. IFF_LOWER_UP conflicts with net/if.h
+			if ((unsigned int)info->ifi_index == index && (info->ifi_flags & IFF_RUNNING) != 0) {
+				carrier = true;
+			}
+		}
+	}
+
+	close(fd);
+
+	if (carrier) {
+		print("Ethernet interface %s has carrier %llu msec after loading %s",
+		      ethernet_interface, (unsigned long long)(milliseconds() - ethernet_driver_loaded), ETHERNET_MODULE);
+	} else {
+		print("Ethernet interface %s has no carrier %d msec after loading %s", ethernet_interface, ETHERNET_CARRIER_TIMEOUT, ETHERNET_MODULE);
+	}
+
+	return NULL;
+}
+
+static void start_ethernet_driver(void)
+{
+	int rc;
+
+	rc = pthread_create(&ethernet_driver_thread, NULL, load_ethernet_driver, NULL);
+
+	if (rc != 0) {
+		panic("could not create thread: %s (%d)", strerror(rc), rc);
+	}
+
+	ethernet_driver_started = true;
+}
+
+// wait for the driver and the interface, then keep waiting for the carrier in
+// the background
+static void finish_ethernet_driver(void)
+{
+	int rc;
+
+	if (!ethernet_driver_started) {
+		return;
+	}
+
+	pthread_join(ethernet_driver_thread, NULL);
+
+	ethernet_driver_started = false;
+	ethernet_driver_finished = true;
+
+	if (ethernet_interface[0] == '\0') {
+		return;
+	}
+
+	rc = pthread_create(&ethernet_carrier_thread, NULL, wait_ethernet_carrier, NULL);
+
+	if (rc != 0) {
+		panic("could not create thread: %s (%d)", strerror(rc), rc);
+	}
+
+	ethernet_carrier_started = true;
+}
+
+// wait until the carrier is logged, at most ETHERNET_CARRIER_TIMEOUT after
+// loading the driver
+static void report_ethernet_carrier(void)
+{
+	if (!ethernet_carrier_started) {
+		return;
+	}
+
+	pthread_join(ethernet_carrier_thread, NULL);
+
+	ethernet_carrier_started = false;
+}
+
+static int ethtool_eeprom(int fd, struct ifreq *ifr, uint32_t cmd, uint32_t offset, void *buffer, uint32_t length)
+{
+	union {
+		struct ethtool_eeprom eeprom;
+		uint8_t bytes[sizeof(struct ethtool_eeprom) + ETHERNET_CONFIG_LENGTH];
+	} u;
+
+	memset(&u.bytes, 0, sizeof(u.bytes));
+
+	u.eeprom.cmd = cmd;
+	u.eeprom.len = length;
+	u.eeprom.offset = offset;
+
+	if (cmd == ETHTOOL_SEEPROM) {
+		u.eeprom.magic = 0x7500;
+
+		memcpy(u.eeprom.data, buffer, length);
+	}
+
+	ifr->ifr_data = (char *)&u.eeprom;
+
+	if (ioctl(fd, SIOCETHTOOL, ifr) < 0) {
+		return -1;
+	}
+
+	if (cmd == ETHTOOL_GEEPROM) {
+		memcpy(buffer, u.eeprom.data, length);
+	}
+
+	return 0;
+}
+
+// read back a written range until it matches, with exponential backoff
+// instead of a fixed sleep. the EEPROM might not answer or still return old
+// content while the write is in progress
+static void wait_ethernet_config(int fd, struct ifreq *ifr, uint32_t offset, uint32_t length)
+{
+	uint8_t buffer[ETHERNET_CONFIG_CHUNK_LENGTH];
+	uint64_t timeout = milliseconds() + ETHERNET_CONFIG_WRITE_TIMEOUT;
+	useconds_t delay = 1000;
+
+	while (true) {
+		if (ethtool_eeprom(fd, ifr, ETHTOOL_GEEPROM, offset, buffer, length) >= 0 &&
+		    memcmp(buffer, eeprom.data_v1.ethernet_config + offset, length) == 0) {
+			return;
+		}
+
+		if (milliseconds() > timeout) {
+			panic("Ethernet config validation failed at offset %u", offset);
+		}
+
+		usleep(delay);
+
+		if (delay < 16000) {
+			delay *= 2;
+		}
+	}
+}
+
+static void configure_ethernet(void)
+{
+	int fd;
+	struct ifreq ifr;
+	uint8_t config[ETHERNET_CONFIG_LENGTH];
+	const uint8_t *expected = eeprom.data_v1.ethernet_config;
+	uint64_t start;
+	size_t begin;
+	size_t end;
+	size_t next;
+	size_t offset;
+	size_t length;
+	size_t written = 0;
+	size_t range_count = 0;
+
+	memset(&ifr, 0, sizeof(ifr));
+
+	if (!eeprom_valid || eeprom.header.data_version < 1) {
+		error("required EEPROM data not available, skipping Ethernet configuration");
+
+		return;
+	}
+
+	// never replace the LAN7500 config with an unprogrammed one
+	if (expected[0] != 0xA5) {
+		error("Ethernet config in EEPROM is not programmed, skipping Ethernet configuration");
+
+		return;
+	}
+
+	// the driver thread already waited for the device
+	if (ethernet_device_missing) {
+		error("Ethernet device %s:%s not found, skipping Ethernet configuration", ETHERNET_VENDOR_ID, ETHERNET_PRODUCT_ID);
+
+		return;
+	}
+
+	// reuse the interface found by the driver thread, only search for it if
+	// that thread didn't run
+	if (ethernet_driver_finished) {
+		memcpy(ifr.ifr_name, ethernet_interface, sizeof(ifr.ifr_name));
+	} else if (!find_ethernet_device(ifr.ifr_name)) {
+		error("Ethernet device %s:%s not found, skipping Ethernet configuration", ETHERNET_VENDOR_ID, ETHERNET_PRODUCT_ID);
+
+		return;
+	}
+
+	ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+
+	// open control socket
+	print("opening ethtool control socket");
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (fd < 0) {
+		fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+
+		if (fd < 0) {
+			panic("could not open ethtool control socket: %s (%d)", strerror(errno), errno);
+		}
+	}
+
+	// compare whole config, a programmed config can still have a stale MAC address
+	print("reading Ethernet config");
+
+	start = milliseconds();
+
+	if (ethtool_eeprom(fd, &ifr, ETHTOOL_GEEPROM, 0, config, ETHERNET_CONFIG_LENGTH) < 0) {
+		panic("could not read Ethernet config: %s (%d)", strerror(errno), errno);
+	}
+
+	if (memcmp(config, expected, ETHERNET_CONFIG_LENGTH) == 0) {
+		print("Ethernet config is already up-to-date, skipping Ethernet configuration");
+		close(fd);
+
+		return;
+	}
+
+	// write differing ranges only
+	begin = 0;
+
+	while (true) {
+		while (begin < ETHERNET_CONFIG_LENGTH && config[begin] == expected[begin]) {
+			++begin;
+		}
+
+		if (begin >= ETHERNET_CONFIG_LENGTH) {
+			break;
+		}
+
+		// extend range over gaps shorter than ETHERNET_CONFIG_MERGE_GAP
+		end = begin + 1;
+		next = end;
+
+		while (next < ETHERNET_CONFIG_LENGTH && next - end < ETHERNET_CONFIG_MERGE_GAP) {
+			if (config[next] != expected[next]) {
+				end = next + 1;
+			}
+
+			++next;
+		}
+
+		print("writing Ethernet config bytes %zu to %zu", begin, end - 1);
+
+		for (offset = begin; offset < end; offset += length) {
+			length = end - offset < ETHERNET_CONFIG_CHUNK_LENGTH ? end - offset : ETHERNET_CONFIG_CHUNK_LENGTH;
+
+			if (ethtool_eeprom(fd, &ifr, ETHTOOL_SEEPROM, offset, (void *)(expected + offset), length) < 0) {
+				panic("could not write Ethernet config: %s (%d)", strerror(errno), errno);
+			}
+
+			wait_ethernet_config(fd, &ifr, offset, length);
+		}
+
+		written += end - begin;
+		++range_count;
+		begin = end;
+	}
+
+	print("wrote %zu of %d Ethernet config bytes in %zu %s in %llu msec",
+	      written, ETHERNET_CONFIG_LENGTH, range_count, range_count == 1 ? "range" : "ranges",
+	      (unsigned long long)(milliseconds() - start));
+
+	close(fd);
+}
+
+// compare all files with their expected content in one batch, then write and
+// stage the ones that are not up-to-date and stage the removal of the removed
+// ones that still exist
+static void update_files(const UpdatedFile *files, size_t file_count)
+{
+	FileOp ops[UPDATED_FILE_COUNT];
+	char buffers[UPDATED_FILE_COUNT][UPDATED_FILE_LENGTH + 1]; // +1 to detect bigger files
+	size_t i;
+	int fd;
+	char tmp_path[256];
+
+	if (file_count > UPDATED_FILE_COUNT) {
+		panic("too many files to update");
+	}
+
+	memset(ops, 0, sizeof(ops));
+
+	for (i = 0; i < file_count; ++i) {
+		ops[i].type = FILE_OP_READ;
+		ops[i].path = files[i].path;
+		ops[i].buffer = buffers[i];
+		ops[i].buffer_length = files[i].content_length + 1;
+	}
+
+	file_batch_run(&file_batch, ops, file_count);
+
+	for (i = 0; i < file_count; ++i) {
+		if (files[i].removed) {
+			if (ops[i].stat_result >= 0) {
+				stage_removal(files[i].path);
+			} else if (ops[i].stat_result != -ENOENT) {
+				error("could not get status of %s: %s (%d)", files[i].path, strerror(-ops[i].stat_result), -ops[i].stat_result);
+			}
+
+			continue;
+		}
+
+		if (ops[i].stat_result < 0) {
+			if (ops[i].stat_result != -ENOENT) {
+				error("could not get status of %s: %s (%d)", files[i].path, strerror(-ops[i].stat_result), -ops[i].stat_result);
+			}
+
+			goto update;
+		} else if (ops[i].statx.stx_mode != (S_IFREG | files[i].mode) || ops[i].statx.stx_uid != 0 || ops[i].statx.stx_gid != 0 ||
+		           ops[i].statx.stx_size != files[i].content_length) {
+			goto update;
+		}
+
+		if (ops[i].result < 0) {
+			error("could not read from %s: %s (%d)", files[i].path, strerror(-ops[i].result), (int)-ops[i].result);
+
+			goto update;
+		}
+
+		if ((size_t)ops[i].result != files[i].content_length) {
+			error("short read from %s", files[i].path);
+
+			goto update;
+		}
+
+		if (memcmp(buffers[i], files[i].content, files[i].content_length) == 0) {
+			print("%s is already up-to-date, skipping update", files[i].path);
+
+			continue;
+		}
+
+update:
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", files[i].path);
+
+		fd = create_file(tmp_path, 0, 0, files[i].mode);
+
+		robust_write(tmp_path, fd, files[i].content, files[i].content_length);
+
+		close(fd);
+
+		stage_rename(tmp_path, files[i].path);
+	}
+}
+
+static int format_production_date(char *buffer, size_t buffer_length)
+{
+	return snprintf(buffer, buffer_length, "%04X-%02X-%02X\n",
+	                eeprom.data_v1.production_date >> 16,
+	                (eeprom.data_v1.production_date >> 8) & 0xFF,
+	                eeprom.data_v1.production_date & 0xFF);
+}
+
+static int format_uid(char *buffer, size_t buffer_length)
+{
+	return snprintf(buffer, buffer_length, "%s\n", eeprom.data_v1.uid);
+}
+
+static int format_hostname(char *buffer, size_t buffer_length)
+{
+	return snprintf(buffer, buffer_length, "%s\n", eeprom.data_v1.hostname);
+}
+
+static int format_mac_address(char *buffer, size_t buffer_length)
+{
+	const uint8_t *ethernet_config = eeprom.data_v1.ethernet_config;
+
+	if (ethernet_config[0] != 0xA5) {
+		return -1; // not programmed
+	}
+
+	return snprintf(buffer, buffer_length, "%02x:%02x:%02x:%02x:%02x:%02x\n",
+	                ethernet_config[1], ethernet_config[2], ethernet_config[3],
+	                ethernet_config[4], ethernet_config[5], ethernet_config[6]);
+}
+
+// append formatted text at offset and return the new offset. if the text
+// doesn't fit then nothing is written, but the offset still grows by its
+// length, so the caller sees the overflow in the final length
+static size_t format_append(char *buffer, size_t buffer_length, size_t offset, const char *format, ...)
+	__attribute__((format(printf, 4, 5)));
+
+static size_t format_append(char *buffer, size_t buffer_length, size_t offset, const char *format, ...)
+{
+	va_list ap;
+	int needed;
+
+	va_start(ap, format);
+	needed = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+
+	if (needed < 0) {
+		panic("could not format generated file content");
+	}
+
+	if (offset >= buffer_length || (size_t)needed >= buffer_length - offset) {
+		return offset + needed;
+	}
+
+	va_start(ap, format);
+	vsnprintf(buffer + offset, buffer_length - offset, format, ap);
+	va_end(ap);
+
+	return offset + needed;
+}
+
+// append string as JSON string literal
+static size_t format_json_string(char *buffer, size_t buffer_length, size_t offset, const char *string)
+{
+	const char *p;
+
+	offset = format_append(buffer, buffer_length, offset, "\"");
 
-	if (fd < 0) {
-		panic("could not open %s for reading: %s (%d)", SHADOW_PATH, strerror(errno), errno);
+	for (p = string; *p != '\0'; ++p) {
+		if (*p == '"' || *p == '\\') {
+			offset = format_append(buffer, buffer_length, offset, "\\%c", *p);
+		} else if ((uint8_t)*p < 0x20) {
+			offset = format_append(buffer, buffer_length, offset, "\\u%04x", (uint8_t)*p);
+		} else {
+			offset = format_append(buffer, buffer_length, offset, "%c", *p);
+		}
 	}
 
-	if (fstat(fd, &st) < 0) {
-		panic("could not get status of %s: %s (%d)", SHADOW_PATH, strerror(errno), errno);
+	return format_append(buffer, buffer_length, offset, "\"");
+}
+
+static int format_summary(char *buffer, size_t buffer_length)
+{
+	char production_date[16];
+	char mac_address[32];
+	size_t offset = 0;
+
+	format_production_date(production_date, sizeof(production_date));
+	production_date[strcspn(production_date, "\n")] = '\0';
+
+	offset = format_append(buffer, buffer_length, offset,
+	                       "{\"data_version\": %u, \"production_date\": \"%s\", \"uid\": ",
+	                       eeprom.header.data_version, production_date);
+	offset = format_json_string(buffer, buffer_length, offset, eeprom.data_v1.uid);
+	offset = format_append(buffer, buffer_length, offset, ", \"hostname\": ");
+	offset = format_json_string(buffer, buffer_length, offset, eeprom.data_v1.hostname);
+
+	if (format_mac_address(mac_address, sizeof(mac_address)) < 0) {
+		offset = format_append(buffer, buffer_length, offset, ", \"mac_address\": null}\n");
+	} else {
+		mac_address[strcspn(mac_address, "\n")] = '\0';
+		offset = format_append(buffer, buffer_length, offset, ", \"mac_address\": \"%s\"}\n", mac_address);
 	}
 
-	if (st.st_size > SHADOW_BUFFER_LENGTH) {
-		panic("%s is too big", SHADOW_PATH);
+	// the caller rejects a length that doesn't fit its buffer
+	return offset > INT_MAX ? INT_MAX : (int)offset;
+}
+
+// all files derived from the EEPROM data. adding a file here only adds a statx
+// to the batch that reads the digest on a normal boot
+static const GeneratedFile generated_files[] = {
+	{"/mnt/etc/tng-base-production-date", 0444, 1, format_production_date},
+	{"/mnt/etc/tng-base-uid", 0444, 1, format_uid},
+	{"/mnt/etc/tng-base-hostname", 0444, 1, format_hostname},
+	{"/mnt/etc/tng-base-mac-address", 0444, 1, format_mac_address},
+	{"/mnt/etc/tng-base-eeprom.json", 0444, 1, format_summary},
+};
+
+// read the digest of the last boot and stat all generated files in one batch.
+// the files only count as up-to-date if the digest matches and each of them
+// exists with the expected size, or is absent if it was removed
+static bool check_generated_files(const UpdatedFile *files, size_t file_count, const GeneratedDigest *digest)
+{
+	FileOp ops[UPDATED_FILE_COUNT + 1];
+	GeneratedDigest stored_digest;
+	size_t i;
+
+	if (file_count > UPDATED_FILE_COUNT) {
+		panic("too many generated files");
 	}
 
-	// read /etc/shadow
-	print("reading %s", SHADOW_PATH);
+	memset(ops, 0, sizeof(ops));
 
-	buffer_used = st.st_size;
-	buffer = malloc(buffer_used + 1); // +1 for null-terminator
+	ops[0].type = FILE_OP_READ;
+	ops[0].path = GENERATED_DIGEST_PATH;
+	ops[0].buffer = &stored_digest;
+	ops[0].buffer_length = sizeof(stored_digest);
 
-	if (buffer == NULL) {
-		panic("could not allocate memory");
+	for (i = 0; i < file_count; ++i) {
+		ops[i + 1].type = FILE_OP_STAT;
+		ops[i + 1].path = files[i].path;
 	}
 
-	length = read(fd, buffer, buffer_used);
+	file_batch_run(&file_batch, ops, file_count + 1);
 
-	if (length < 0) {
-		panic("could not read from %s: %s (%d)", SHADOW_PATH, strerror(errno), errno);
+	if (ops[0].result < 0) {
+		if (ops[0].result != -ENOENT) {
+			error("could not read from %s: %s (%d)", GENERATED_DIGEST_PATH, strerror(-ops[0].result), (int)-ops[0].result);
+		}
+
+		return false;
 	}
 
-	if ((size_t)length < buffer_used) {
-		panic("short read from %s: %s (%d)", SHADOW_PATH, strerror(errno), errno);
+	if ((size_t)ops[0].result != sizeof(stored_digest) || stored_digest.magic_number != GENERATED_DIGEST_MAGIC_NUMBER ||
+	    stored_digest.checksum != digest->checksum) {
+		return false;
 	}
 
-	buffer[buffer_used] = '\0';
+	for (i = 0; i < file_count; ++i) {
+		if (files[i].removed) {
+			if (ops[i + 1].stat_result != -ENOENT) {
+				print("%s matches, but removed %s is still present", GENERATED_DIGEST_PATH, files[i].path);
 
-	print("closing %s", SHADOW_PATH);
+				return false;
+			}
 
-	close(fd);
+			continue;
+		}
 
-	// find entry for account
-	if (strncmp(buffer, ACCOUNT_NAME":", strlen(ACCOUNT_NAME":")) == 0) {
-		entry_begin = buffer;
-	} else {
-		entry_begin = strstr(buffer, "\n"ACCOUNT_NAME":");
+		if (ops[i + 1].stat_result < 0) {
+			if (ops[i + 1].stat_result != -ENOENT) {
+				error("could not get status of %s: %s (%d)", files[i].path, strerror(-ops[i + 1].stat_result), -ops[i + 1].stat_result);
+			}
 
-		if (entry_begin == NULL) {
-			print("account %s is not present, skipping password replacement", ACCOUNT_NAME);
+			print("%s matches, but %s is missing", GENERATED_DIGEST_PATH, files[i].path);
 
-			goto cleanup;
+			return false;
 		}
 
-		++entry_begin; // skip new-line
-	}
-
-	// find encrypted section in entry
-	encrypted_begin = strchr(entry_begin, ':');
+		if (ops[i + 1].statx.stx_size != files[i].content_length) {
+			print("%s matches, but %s has the wrong size", GENERATED_DIGEST_PATH, files[i].path);
 
-	if (encrypted_begin == NULL) {
-		panic("encrypted section for account %s is malformed", ACCOUNT_NAME);
+			return false;
+		}
 	}
 
-	++encrypted_begin; // skip colon
+	return true;
+}
 
-	if (encrypted_begin[0] == '*') {
-		print("account %s has no password set, skipping password replacement", ACCOUNT_NAME);
+static void store_generated_digest(const GeneratedDigest *digest)
+{
+	int fd;
 
-		goto cleanup;
-	}
+	fd = create_file(GENERATED_DIGEST_PATH".tmp", 0, 0, 0444);
 
-	if (encrypted_begin[0] != '!') {
-		print("account %s is not locked, skipping password replacement", ACCOUNT_NAME);
+	robust_write(GENERATED_DIGEST_PATH".tmp", fd, digest, sizeof(*digest));
 
-		goto cleanup;
-	}
+	close(fd);
 
-	encrypted_end = strchr(encrypted_begin, ':');
+	stage_rename(GENERATED_DIGEST_PATH".tmp", GENERATED_DIGEST_PATH);
+}
 
-	if (encrypted_end == NULL) {
-		panic("encrypted section for account %s is malformed", ACCOUNT_NAME);
+// format all generated files and compare them with the digest of the last
+// boot. only on mismatch or a missing or resized file the files are compared
+// and updated. the digest is staged after the files, so it is only replaced
+// after all files got replaced
+static void generate_files(void)
+{
+	static UpdatedFile files[UPDATED_FILE_COUNT];
+	size_t file_count = 0;
+	size_t i;
+	int length;
+	uint32_t mode;
+	uint32_t content_length;
+	GeneratedDigest digest;
+
+	if (sizeof(generated_files) / sizeof(generated_files[0]) > UPDATED_FILE_COUNT) {
+		panic("too many generated files");
 	}
 
-	encrypted_used = encrypted_end - (encrypted_begin + 1); // +1 to skip exclamation mark
+	memset(&digest, 0, sizeof(digest));
 
-	if (encrypted_used > SHADOW_ENCRYPTED_LENGTH) {
-		panic("encrypted section for account %s is too big", ACCOUNT_NAME);
-	}
+	digest.magic_number = GENERATED_DIGEST_MAGIC_NUMBER;
+	digest.checksum = crc32(0, Z_NULL, 0);
 
-	memcpy(encrypted, encrypted_begin + 1, encrypted_used); // +1 to skip exclamation mark
+	for (i = 0; i < sizeof(generated_files) / sizeof(generated_files[0]); ++i) {
+		if (eeprom.header.data_version < generated_files[i].data_version) {
+			continue;
+		}
 
-	encrypted[encrypted_used] = '\0';
+		length = generated_files[i].format(files[file_count].content, sizeof(files[file_count].content));
 
-	// get salt from encrypted section
-	if (encrypted_used < 2) {
-		panic("encrypted section for account %s is malformed", ACCOUNT_NAME);
-	}
+		// don't leave a file behind that doesn't match the EEPROM data anymore
+		if (length < 0) {
+			print("%s cannot be derived from EEPROM data, removing it if present", generated_files[i].path);
 
-	if (encrypted[0] != '$') {
-		salt_used = 2;
-	} else {
-		encrypted_prefix_end = strrchr(encrypted, '$');
+			files[file_count].path = generated_files[i].path;
+			files[file_count].mode = generated_files[i].mode;
+			files[file_count].content_length = 0;
+			files[file_count].removed = true;
 
-		if (encrypted_prefix_end == NULL) {
-			panic("encrypted section for account %s is malformed", ACCOUNT_NAME);
+			++file_count;
+
+			continue;
 		}
 
-		salt_used = encrypted_prefix_end - encrypted;
-	}
+		if ((size_t)length >= sizeof(files[file_count].content)) {
+			panic("content of %s is too long", generated_files[i].path);
+		}
 
-	memcpy(salt, encrypted, salt_used);
+		files[file_count].path = generated_files[i].path;
+		files[file_count].mode = generated_files[i].mode;
+		files[file_count].content_length = length;
+		files[file_count].removed = false;
 
-	salt[salt_used] = '\0';
+		mode = generated_files[i].mode;
+		content_length = length;
 
-	// encrypt default password with salt from encrypted section
-	crypt_result = crypt_r(DEFAULT_PASSWORD, salt, &crypt_data);
+		digest.checksum = crc32(digest.checksum, (uint8_t *)generated_files[i].path, strlen(generated_files[i].path) + 1);
+		digest.checksum = crc32(digest.checksum, (uint8_t *)&mode, sizeof(mode));
+		digest.checksum = crc32(digest.checksum, (uint8_t *)&content_length, sizeof(content_length));
+		digest.checksum = crc32(digest.checksum, (uint8_t *)files[file_count].content, content_length);
 
-	if (crypt_result == NULL) {
-		panic("could not encrypt default password: %s (%d)", strerror(errno), errno);
+		++file_count;
 	}
 
-	if (strcmp(crypt_result, encrypted) != 0) {
-		print("account %s does not have the default password set, skipping password replacement", ACCOUNT_NAME);
+	if (cmdline.force) {
+		print("ignoring %s (tng.force)", GENERATED_DIGEST_PATH);
+	} else if (check_generated_files(files, file_count, &digest)) {
+		print("%s matches, all generated files are already up-to-date", GENERATED_DIGEST_PATH);
 
-		goto cleanup;
+		return;
 	}
 
-	print("account %s has default password set, replacing with device specific password", ACCOUNT_NAME);
+	update_files(files, file_count);
+	store_generated_digest(&digest);
+}
 
-	// create /etc/shadow-
-	fd = create_file(SHADOW_BACKUP_PATH, st.st_uid, st.st_gid, st.st_mode);
+// split the next option off the command line the same way the kernel does:
+// options are separated by whitespace, double quotes group whitespace and are
+// removed. returns NULL at the end of the command line
+static char *next_option(char **cursor, char **value)
+{
+	char *p = *cursor;
+	char *option;
+	char *q;
+	bool quoted = false;
 
-	robust_write(SHADOW_BACKUP_PATH, fd, buffer, buffer_used);
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+		++p;
+	}
 
-	print("closing %s", SHADOW_BACKUP_PATH);
+	if (*p == '\0') {
+		return NULL;
+	}
 
-	fsync(fd);
-	close(fd);
+	option = p;
+	q = p;
+	*value = NULL;
 
-	// create /etc/shadow+
-	fd = create_file(SHADOW_TMP_PATH, st.st_uid, st.st_gid, st.st_mode);
+	for (; *p != '\0'; ++p) {
+		if (*p == '"') {
+			quoted = !quoted;
 
-	robust_write(SHADOW_TMP_PATH, fd, buffer, encrypted_begin - buffer);
-	robust_write(SHADOW_TMP_PATH, fd, eeprom.data_v1.encrypted_password, strlen(eeprom.data_v1.encrypted_password));
-	robust_write(SHADOW_TMP_PATH, fd, encrypted_end, buffer_used - (encrypted_end - buffer));
+			continue;
+		}
 
-	print("closing %s", SHADOW_TMP_PATH);
+		if (!quoted && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+			++p;
 
-	fsync(fd);
-	close(fd);
+			break;
+		}
 
-	// rename /etc/shadow+ to /etc/shadow
-	print("renaming %s to %s", SHADOW_TMP_PATH, SHADOW_PATH);
+		if (*p == '=' && *value == NULL) {
+			*q++ = '\0';
+			*value = q;
+
+			continue;
+		}
 
-	if (rename(SHADOW_TMP_PATH, SHADOW_PATH) < 0) {
-		panic("could not rename %s to %s: %s (%d)", SHADOW_TMP_PATH, SHADOW_PATH, strerror(errno), errno);
+		*q++ = *p;
 	}
 
-cleanup:
-	free(buffer);
+	*q = '\0';
+	*cursor = p;
+
+	return option;
 }
 
-static void configure_ethernet(void)
+static int parse_phase(const char *name, size_t length)
 {
-	DIR *dp;
-	struct dirent *dirent;
-	int fd;
-	struct ifreq ifr;
-	union {
-		struct ethtool_eeprom eeprom;
-		uint8_t bytes[sizeof(struct ethtool_eeprom) + ETHERNET_CONFIG_LENGTH];
-	} u;
-
-	if (!eeprom_valid || eeprom.header.data_version < 1) {
-		error("required EEPROM data not available, skipping Ethernet configuration");
+	int i;
 
-		return;
+	for (i = 0; i < PHASE_COUNT; ++i) {
+		if (strlen(phase_names[i]) == length && strncmp(phase_names[i], name, length) == 0) {
+			return i;
+		}
 	}
 
-	// find Ethernet device name
-	print("looking up Ethernet device name");
+	error("unknown phase '%.*s' on kernel command line", (int)length, name);
 
-	dp = opendir(ETHERNET_DEVICE_PATH"net/");
+	return -1;
+}
 
-	if (dp == NULL) {
-		panic("could not open net/ subdirectory of Ethernet device %s: %s (%d)",
-		      ETHERNET_DEVICE_PATH, strerror(errno), errno);
+static bool parse_number(const char *option, const char *value, long minimum, long maximum, long *number)
+{
+	char *end;
+
+	if (value == NULL || *value == '\0') {
+		error("kernel command line option %s is missing a value", option);
+
+		return false;
 	}
 
 	errno = 0;
-	dirent = readdir(dp);
+	*number = strtol(value, &end, 10);
 
-	if (dirent == NULL) {
-		panic("could not read net/ subdirectory of Ethernet device %s: %s (%d)",
-		      ETHERNET_DEVICE_PATH, strerror(errno), errno);
-	}
+	if (errno != 0 || *end != '\0' || *number < minimum || *number > maximum) {
+		error("invalid value for kernel command line option %s: %s", option, value);
 
-	if (dirent->d_type != DT_DIR) {
-		panic("directory entry %s of %snet/ has unexpected type: %d",
-		      dirent->d_name, ETHERNET_DEVICE_PATH, dirent->d_type);
+		return false;
 	}
 
-	if (strlen(dirent->d_name) >= IFNAMSIZ) {
-		panic("Ethernet device name %s is too long: %u > %u",
-		      dirent->d_name, strlen(dirent->d_name), IFNAMSIZ - 1);
+	return true;
+}
+
+static void parse_tng_option(const char *option, const char *value)
+{
+	const char *p;
+	size_t length;
+	int phase;
+	long number;
+
+	if (strcmp(option, "tng.skip") == 0) {
+		for (p = value != NULL ? value : ""; *p != '\0'; p += length + (p[length] == ',' ? 1 : 0)) {
+			length = strcspn(p, ",");
+			phase = parse_phase(p, length);
+
+			if (phase >= 0) {
+				cmdline.skip |= 1u << phase;
+			}
+		}
+	} else if (strcmp(option, "tng.force") == 0) {
+		cmdline.force = value == NULL || strcmp(value, "0") != 0;
+	} else if (strncmp(option, "tng.budget.", 11) == 0) {
+		phase = parse_phase(option + 11, strlen(option + 11));
+
+		if (phase >= 0 && parse_number(option, value, 1, 3600000, &number)) {
+			cmdline.budgets[phase] = number;
+		}
+	} else if (strcmp(option, "tng.loglevel") == 0) {
+		if (parse_number(option, value, 0, LOG_LEVEL_INFO, &number)) {
+			cmdline.log_level = number;
+		}
+	} else if (strcmp(option, "tng.uring") == 0) {
+		if (parse_number(option, value, 0, 1, &number)) {
+			cmdline.uring = number != 0;
+		}
+	} else if (strcmp(option, "tng.performance") == 0) {
+		if (parse_number(option, value, 0, 1, &number)) {
+			cmdline.performance = number != 0;
+		}
+	} else if (strcmp(option, "tng.governor") == 0) {
+		if (value == NULL || *value == '\0' || strlen(value) >= sizeof(cpu_policies[0].governor)) {
+			error("invalid value for kernel command line option %s", option);
+		} else {
+			cmdline.governor = value;
+		}
+	} else if (strcmp(option, "tng.zram.size") == 0) {
+		cmdline.zram_size = value;
+	} else if (strcmp(option, "tng.zram.algorithm") == 0) {
+		cmdline.zram_algorithm = value;
+	} else if (strcmp(option, "tng.varlog.size") == 0) {
+		cmdline.varlog_size = value;
+	} else if (strcmp(option, "tng.irq.usb") == 0) {
+		cmdline.irq_usb = value;
+	} else if (strcmp(option, "tng.nice") == 0) {
+		if (parse_number(option, value, -20, 19, &number)) {
+			cmdline.nice = number;
+		}
+	} else {
+		error("unknown kernel command line option %s", option);
 	}
+}
 
-	print("found Ethernet device name: %s", dirent->d_name);
+// move a mount point into the new root. if that fails it's unmounted instead
+// and the new root has to mount it again. for devtmpfs this is done here,
+// because the new root would not be usable without it
+static void move_mount_point(const char *path, const char *fallback_type)
+{
+	char target[64];
+	uint64_t start = microseconds();
 
-	memset(&ifr, 0, sizeof(ifr));
-	memcpy(ifr.ifr_name, dirent->d_name, IFNAMSIZ);
+	snprintf(target, sizeof(target), "/mnt%s", path);
 
-	closedir(dp);
+	print("moving %s to %s", path, target);
 
-	ifr.ifr_name[IFNAMSIZ - 1] = '\0';
-	ifr.ifr_data = (char *)&u.eeprom;
+	if (mount(path, target, NULL, MS_MOVE, NULL) >= 0) {
+		print("moved %s to %s in %llu usec", path, target, (unsigned long long)(microseconds() - start));
 
-	// open control socket
-	print("opening ethtool control socket");
+		return;
+	}
 
-	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	error("could not move %s to %s, unmounting it instead: %s (%d)", path, target, strerror(errno), errno);
 
-	if (fd < 0) {
-		fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (umount2(path, MNT_DETACH) < 0) {
+		panic("could not unmount %s: %s (%d)", path, strerror(errno), errno);
+	}
 
-		if (fd < 0) {
-			panic("could not open ethtool control socket: %s (%d)", strerror(errno), errno);
+	if (fallback_type != NULL) {
+		print("mounting %s at %s", fallback_type, target);
+
+		if (mount(fallback_type, target, fallback_type, 0, "") < 0) {
+			panic("could not mount %s at %s: %s (%d)", fallback_type, target, strerror(errno), errno);
 		}
 	}
+}
+
+// returns MemAvailable in kB from the already open /proc/meminfo, or -1 on
+// error. the file descriptor stays usable after /proc was moved or unmounted
+static long read_mem_available(int meminfo_fd)
+{
+	char buffer[512]; // MemAvailable is the third line
+	ssize_t length;
+	char *line;
+	long available;
+
+	if (meminfo_fd < 0) {
+		return -1;
+	}
 
-	// check if config is already set
-	print("reading first Ethernet config byte");
+	length = pread(meminfo_fd, buffer, sizeof(buffer) - 1, 0);
 
-	memset(&u.bytes, 0, sizeof(u.bytes));
+	if (length < 0) {
+		error("could not read from /proc/meminfo: %s (%d)", strerror(errno), errno);
+
+		return -1;
+	}
 
-	u.eeprom.cmd = ETHTOOL_GEEPROM;
-	u.eeprom.len = 1;
-	u.eeprom.offset = 0;
+	buffer[length] = '\0';
+	line = strstr(buffer, "MemAvailable:");
 
-	if (ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
-		panic("could not read first Ethernet config byte: %s (%d)", strerror(errno), errno);
+	if (line == NULL || sscanf(line, "MemAvailable: %ld kB", &available) != 1) {
+		return -1;
 	}
 
-	if (u.eeprom.data[0] == 0xA5) {
-		print("Ethernet already configured, skipping Ethernet configuration");
+	return available;
+}
+
+// recursively delete everything in directory fd that is on the device
+// root_dev (logic taken from busybox switch_root delete_contents). the mount
+// points of other filesystems are kept, but their content is not touched
+static void delete_contents(int fd, const char *path, dev_t root_dev)
+{
+	DIR *dp;
+	struct dirent *dirent;
+	struct stat st;
+	int child_fd;
+	char child_path[PATH_MAX];
+
+	dp = fdopendir(fd);
+
+	if (dp == NULL) {
+		error("could not open directory %s: %s (%d)", path, strerror(errno), errno);
 		close(fd);
 
 		return;
 	}
 
-	// write config
-	print("writing Ethernet config");
+	while ((dirent = readdir(dp)) != NULL) {
+		if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+			continue;
+		}
 
-	memset(&u.bytes, 0, sizeof(u.bytes));
+		// carry the full path through the recursion for the error messages
+		if ((size_t)snprintf(child_path, sizeof(child_path), "%s/%s", path, dirent->d_name) >= sizeof(child_path)) {
+			error("path of %s/%s is too long", path, dirent->d_name);
 
-	u.eeprom.cmd = ETHTOOL_SEEPROM;
-	u.eeprom.len = ETHERNET_CONFIG_LENGTH;
-	u.eeprom.offset = 0;
-	u.eeprom.magic = 0x7500;
+			continue;
+		}
 
-	memcpy(u.eeprom.data, eeprom.data_v1.ethernet_config, ETHERNET_CONFIG_LENGTH);
+		if (fstatat(dirfd(dp), dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			error("could not get status of %s: %s (%d)", child_path, strerror(errno), errno);
 
-	if (ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
-		panic("could not write Ethernet config: %s (%d)", strerror(errno), errno);
-	}
+			continue;
+		}
 
-	usleep(100 * 1000); // wait 100 msec to let everything settle
+		if (st.st_dev != root_dev) {
+			continue; // other filesystem, e.g. /mnt
+		}
 
-	// validate config
-	print("validating Ethernet config");
+		if (S_ISDIR(st.st_mode)) {
+			child_fd = openat(dirfd(dp), dirent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
 
-	memset(&u.bytes, 0, sizeof(u.bytes));
+			if (child_fd < 0) {
+				error("could not open directory %s: %s (%d)", child_path, strerror(errno), errno);
 
-	u.eeprom.cmd = ETHTOOL_GEEPROM;
-	u.eeprom.len = ETHERNET_CONFIG_LENGTH;
-	u.eeprom.offset = 0;
+				continue;
+			}
 
-	if (ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
-		panic("could not read Ethernet config: %s (%d)", strerror(errno), errno);
-	}
+			delete_contents(child_fd, child_path, root_dev);
 
-	if (memcmp(u.eeprom.data, eeprom.data_v1.ethernet_config, ETHERNET_CONFIG_LENGTH) != 0) {
-		panic("Ethernet config validation failed");
+			if (unlinkat(dirfd(dp), dirent->d_name, AT_REMOVEDIR) < 0 && errno != EBUSY) {
+				error("could not remove directory %s: %s (%d)", child_path, strerror(errno), errno);
+			}
+		} else if (unlinkat(dirfd(dp), dirent->d_name, 0) < 0) {
+			error("could not remove %s: %s (%d)", child_path, strerror(errno), errno);
+		}
 	}
 
-	close(fd);
+	closedir(dp);
 }
 
-void update_file(const char *path, void *content, size_t content_length)
+// free the memory used by the initramfs content. only done if / really is
+// the initramfs, to never wipe a real disk by accident. meminfo_fd is only used
+// to log the freed memory
+static void delete_initramfs(int meminfo_fd)
 {
+	struct statfs stfs;
 	struct stat st;
 	int fd;
-	char buffer[content_length];
-	ssize_t length;
-	char tmp_path[256];
+	long available_before;
+	long available_after;
 
-	if (stat(path, &st) < 0) {
-		if (errno != ENOENT) {
-			error("could not get status of %s: %s (%d)", path, strerror(errno), errno);
-		}
+	if (statfs("/", &stfs) < 0) {
+		error("could not get filesystem status of /: %s (%d)", strerror(errno), errno);
 
-		goto update;
-	} else if (st.st_mode != (S_IFREG | 0444) || st.st_uid != 0 || st.st_gid != 0 ||
-	           (size_t)st.st_size != content_length) {
-		goto update;
+		return;
 	}
 
-	fd = open(path, O_RDONLY);
-
-	if (fd < 0) {
-		error("could not open %s for reading: %s (%d)", path, strerror(errno), errno);
+	if (stfs.f_type != RAMFS_MAGIC && stfs.f_type != TMPFS_MAGIC) {
+		error("/ is not an initramfs, not deleting its content");
 
-		goto update;
+		return;
 	}
 
-	length = read(fd, buffer, st.st_size);
-
-	close(fd);
-
-	if (length < 0) {
-		error("could not read from %s: %s (%d)", path, strerror(errno), errno);
-
-		goto update;
-	}
+	fd = open("/", O_RDONLY | O_DIRECTORY);
 
-	if (length < st.st_size) {
-		error("short read from %s: %s (%d)", path, strerror(errno), errno);
+	if (fd < 0) {
+		error("could not open /: %s (%d)", strerror(errno), errno);
 
-		goto update;
+		return;
 	}
 
-	if (memcmp(buffer, content, content_length) == 0) {
-		print("%s is already up-to-date, skipping update", path);
+	if (fstat(fd, &st) < 0) {
+		error("could not get status of /: %s (%d)", strerror(errno), errno);
+		close(fd);
 
 		return;
 	}
 
-update:
-	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
-
-	fd = create_file(tmp_path, 0, 0, 0444);
+	available_before = read_mem_available(meminfo_fd);
 
-	robust_write(tmp_path, fd, content, content_length);
+	print("deleting initramfs content");
 
-	fsync(fd);
-	close(fd);
+	delete_contents(fd, "", st.st_dev);
 
-	print("renaming %s to %s", tmp_path, path);
+	available_after = read_mem_available(meminfo_fd);
 
-	if (rename(tmp_path, path) < 0) {
-		panic("could not rename %s to %s: %s (%d)", tmp_path, path, strerror(errno), errno);
+	if (available_before >= 0 && available_after >= 0) {
+		print("deleted initramfs content, MemAvailable %ld kB -> %ld kB (%+ld kB)",
+		      available_before, available_after, available_after - available_before);
 	}
 }
 
-static void read_cmdline(const char **root, const char **rootfstype, const char **init)
+static void read_cmdline(int argc, char **argv)
 {
 	int fd;
-	static char buffer[2048];
-	ssize_t length;
+	char *buffer = NULL;
+	size_t buffer_length = 0;
+	size_t length = 0;
+	ssize_t read_length;
+	char *cursor;
 	char *option;
+	char *value;
+	long number;
+	int i;
+
+	memset(&cmdline, 0, sizeof(cmdline));
 
-	*root = NULL;
-	*rootfstype = NULL;
-	*init = NULL;
+	cmdline.rootdelay = -1;
+	cmdline.log_level = LOG_LEVEL_INFO;
+	cmdline.uring = true;
+	cmdline.performance = true;
 
 	print("reading /proc/cmdline");
 
-	// read /proc/cmdline
+	// read /proc/cmdline, its maximum length depends on the architecture
 	fd = open("/proc/cmdline", O_RDONLY);
 
 	if (fd < 0) {
 		panic("could not open /proc/cmdline for reading: %s (%d)", strerror(errno), errno);
 	}
 
-	length = read(fd, buffer, sizeof(buffer) - 1);
+	do {
+		if (length + 1 >= buffer_length) {
+			buffer_length += 2048;
+			buffer = realloc(buffer, buffer_length);
 
-	if (length < 0) {
-		panic("could not read from /proc/cmdline: %s (%d)", strerror(errno), errno);
-	}
+			if (buffer == NULL) {
+				panic("could not allocate /proc/cmdline buffer");
+			}
+		}
+
+		read_length = read(fd, buffer + length, buffer_length - length - 1);
+
+		if (read_length < 0) {
+			panic("could not read from /proc/cmdline: %s (%d)", strerror(errno), errno);
+		}
+
+		length += read_length;
+	} while (read_length > 0);
 
 	close(fd);
 
 	buffer[length] = '\0';
 
-	// parse /proc/cmdline
-	option = strtok(buffer, "\r\n\t ");
+	// parse /proc/cmdline. the buffer is intentionally never freed, because
+	// the options point into it
+	cursor = buffer;
+
+	while ((option = next_option(&cursor, &value)) != NULL) {
+		if (strcmp(option, "--") == 0) {
+			break; // the rest is for init, the kernel passed it as argv already
+		} else if (strcmp(option, "root") == 0) {
+			cmdline.root = value;
+		} else if (strcmp(option, "rootfstype") == 0) {
+			cmdline.rootfstype = value;
+		} else if (strcmp(option, "rootflags") == 0) {
+			cmdline.rootflags = value;
+		} else if (strcmp(option, "ro") == 0 && value == NULL) {
+			cmdline.ro = true;
+		} else if (strcmp(option, "rw") == 0 && value == NULL) {
+			cmdline.ro = false;
+		} else if (strcmp(option, "rootwait") == 0 && value == NULL) {
+			// nothing to do, the root device is always waited for
+		} else if (strcmp(option, "rootdelay") == 0) {
+			if (parse_number(option, value, 0, 3600, &number)) {
+				cmdline.rootdelay = number;
+			}
+		} else if (strcmp(option, "init") == 0) {
+			cmdline.init = value;
+		} else if (strncmp(option, "tng.", 4) == 0) {
+			parse_tng_option(option, value);
+		}
+	}
+
+	if (cmdline.root == NULL) {
+		cmdline.root = "/dev/mmcblk0p2";
+	}
+
+	if (cmdline.rootfstype == NULL) {
+		cmdline.rootfstype = "ext4";
+	}
+
+	if (cmdline.init == NULL) {
+		cmdline.init = "/sbin/init";
+	}
+
+	// the kernel passes options it doesn't know and everything after -- to
+	// init as arguments, forward them to the real init
+	cmdline.init_args[0] = cmdline.init;
+	cmdline.init_arg_count = 1;
 
-	while (option != NULL) {
-		if (strncmp(option, "root=", 5) == 0) {
-			*root = option + 5;
-		} else if (strncmp(option, "rootfstype=", 11) == 0) {
-			*rootfstype = option + 11;
-		} else if (strncmp(option, "init=", 5) == 0) {
-			*init = option + 5;
+	for (i = 1; i < argc; ++i) {
+		if (cmdline.init_arg_count >= INIT_ARG_COUNT) {
+			error("too many init arguments, ignoring %s", argv[i]);
+
+			continue;
 		}
 
-		option = strtok(NULL, "\r\n\t ");
+		cmdline.init_args[cmdline.init_arg_count++] = argv[i];
 	}
+
+	cmdline.init_args[cmdline.init_arg_count] = NULL;
 }
 
-int main(void)
+static bool begin_phase(Phase phase)
 {
-	const char *root;
-	const char *rootfstype;
-	const char *init;
-	char buffer[256];
-	const char *execv_argv[] = {NULL, NULL};
+	if ((cmdline.skip & (1u << phase)) != 0) {
+		print("skipping %s phase (tng.skip)", phase_names[phase]);
+
+		return false;
+	}
+
+	phase_start = milliseconds();
+
+	return true;
+}
+
+static void end_phase(Phase phase)
+{
+	uint64_t elapsed = milliseconds() - phase_start;
+
+	if (cmdline.budgets[phase] > 0 && elapsed > cmdline.budgets[phase]) {
+		error("%s phase took %llu msec, exceeding its budget of %u msec",
+		      phase_names[phase], (unsigned long long)elapsed, cmdline.budgets[phase]);
+	} else {
+		print("%s phase took %llu msec", phase_names[phase], (unsigned long long)elapsed);
+	}
+}
+
+#ifndef TNG_PROVISION
+
+int main(int argc, char **argv)
+{
+	int meminfo_fd;
 
 	// open /dev/kmsg
 	kmsg_fd = open("/dev/kmsg", O_WRONLY);
 
+	print("started %llu msec after boot", (unsigned long long)boot_milliseconds());
+
 	// mount /proc
 	print("mounting proc at /proc");
 
@@ -1083,19 +4440,7 @@ int main(void)
 	}
 
 	// read cmdline
-	read_cmdline(&root, &rootfstype, &init);
-
-	if (root == NULL) {
-		root = "/dev/mmcblk0p2";
-	}
-
-	if (rootfstype == NULL) {
-		rootfstype = "ext4";
-	}
-
-	if (init == NULL) {
-		init = "/sbin/init";
-	}
+	read_cmdline(argc, argv);
 
 	// mount /sys
 	print("mounting sysfs at /sys");
@@ -1104,6 +4449,8 @@ int main(void)
 		panic("could not mount sysfs at /sys: %s (%d)", strerror(errno), errno);
 	}
 
+	enable_performance_profile();
+
 	// mount /dev
 	print("mounting devtmpfs at /dev");
 
@@ -1111,81 +4458,150 @@ int main(void)
 		panic("could not mount devtmpfs at /dev: %s (%d)", strerror(errno), errno);
 	}
 
-	// wait 250 msec for the root device to show up before trying to mount it to
-	// avoid an initial warning about the device not being available yet
-	usleep(250 * 1000);
+	// mount tmpfs at /run. it's handed over to the new root and is then used
+	// by systemd as is, because /run is already a mount point there
+	print("mounting tmpfs at /run");
+
+	if (mount("tmpfs", "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755,size=10%") < 0) {
+		panic("could not mount tmpfs at /run: %s (%d)", strerror(errno), errno);
+	}
+
+	if (mkdir("/run/blkid", 0755) < 0) { // for the libblkid cache used by libmount
+		panic("could not create /run/blkid: %s (%d)", strerror(errno), errno);
+	}
+
+	if (mkdir(EEPROM_CACHE_DIRECTORY, 0755) < 0) {
+		panic("could not create %s: %s (%d)", EEPROM_CACHE_DIRECTORY, strerror(errno), errno);
+	}
+
+	if (cmdline.rootdelay >= 0) {
+		print("waiting %d sec for root device (rootdelay)", cmdline.rootdelay);
+		sleep(cmdline.rootdelay);
+	} else {
+		// wait 250 msec for the root device to show up before trying to mount it to
+		// avoid an initial warning about the device not being available yet
+		usleep(250 * 1000);
+	}
 
-	// mount root at /mnt
-	robust_mount(root, "/mnt", rootfstype, MS_NOATIME);
+	// mount root at /mnt. it's always mounted read-write, because the root is
+	// modified below. with ro it's remounted read-only before switching root
+	robust_mount(cmdline.root, "/mnt", cmdline.rootfstype, root_atime_flags(), cmdline.rootflags);
+
+	// set up batched file operations
+	if (file_batch_init(&file_batch, cmdline.uring)) {
+		print("using io_uring for file operations");
+	} else {
+		print("using synchronous file operations");
+	}
 
-	// mount devtmpfs at /mnt/dev
-	print("mounting devtmpfs at /mnt/dev");
+	// load the Ethernet driver in the background, so the link is negotiated
+	// by the time networking services start. the modules are on the root
+	if ((cmdline.skip & (1u << PHASE_ETHERNET)) == 0) {
+		start_ethernet_driver();
+	}
 
-	if (mount("devtmpfs", "/mnt/dev", "devtmpfs", 0, "") < 0) {
-		panic("could not mount devtmpfs at /mnt/dev: %s (%d)", strerror(errno), errno);
+	// initialize CRNG from the stored random seed
+	if (begin_phase(PHASE_ENTROPY)) {
+		seed_entropy();
+		end_phase(PHASE_ENTROPY);
 	}
 
 	// set system clock from RTC
-	modprobe("i2c_bcm2835");
-	modprobe("rtc_pcf8523");
-	rtc_hctosys();
+	if (begin_phase(PHASE_RTC)) {
+		modprobe("i2c_bcm2835", true);
+		modprobe("rtc_pcf8523", true);
+		rtc_hctosys();
+		end_phase(PHASE_RTC);
+	}
 
 	// read eeprom content
-	modprobe("i2c_dev");
-	read_eeprom();
+	if (begin_phase(PHASE_EEPROM)) {
+		if ((cmdline.skip & (1u << PHASE_RTC)) != 0) {
+			modprobe("i2c_bcm2835", true); // otherwise loaded by the rtc phase
+		}
+
+		modprobe("i2c_dev", true);
+		read_eeprom();
+		write_eeprom_cache();
+		end_phase(PHASE_EEPROM);
+	}
 
 	// replace password if necessary
-	replace_password();
+	if (begin_phase(PHASE_PASSWORD)) {
+		replace_password();
+		end_phase(PHASE_PASSWORD);
+	}
 
 	// configure Ethernet if necessary
-	configure_ethernet();
+	if (begin_phase(PHASE_ETHERNET)) {
+		finish_ethernet_driver();
+		configure_ethernet();
+		end_phase(PHASE_ETHERNET);
+	}
 
 	// write /etc/tng-base-* files
-	if (!eeprom_valid || eeprom.header.data_version < 1) {
-		error("required EEPROM data not available, skip updating /mnt/etc/tng-base-* files");
-	} else {
-		print("updating /mnt/etc/tng-base-* files");
-
-		// production date
-		snprintf(buffer, sizeof(buffer), "%04X-%02X-%02X\n",
-		         eeprom.data_v1.production_date >> 16,
-		         (eeprom.data_v1.production_date >> 8) & 0xFF,
-		         eeprom.data_v1.production_date & 0xFF);
-
-		update_file("/mnt/etc/tng-base-production-date", buffer, strlen(buffer));
-
-		// UID
-		snprintf(buffer, sizeof(buffer), "%s\n", eeprom.data_v1.uid);
+	if (begin_phase(PHASE_FILES)) {
+		if (!eeprom_valid || eeprom.header.data_version < 1) {
+			error("required EEPROM data not available, skip updating /mnt/etc/tng-base-* files");
+		} else {
+			print("updating /mnt/etc/tng-base-* files");
+			generate_files();
+		}
 
-		update_file("/mnt/etc/tng-base-uid", buffer, strlen(buffer));
+		end_phase(PHASE_FILES);
+	}
 
-		// hostname
-		snprintf(buffer, sizeof(buffer), "%s\n", eeprom.data_v1.hostname);
+	// set up zram swap if configured
+	if (begin_phase(PHASE_ZRAM)) {
+		setup_zram();
+		end_phase(PHASE_ZRAM);
+	}
 
-		update_file("/mnt/etc/tng-base-hostname", buffer, strlen(buffer));
+	// set up RAM-backed /var/log if configured
+	if (begin_phase(PHASE_VARLOG)) {
+		setup_varlog();
+		end_phase(PHASE_VARLOG);
 	}
 
-	// unmount /proc
-	print("unmounting /proc");
+	// steer USB interrupts to their own CPU if configured
+	if (begin_phase(PHASE_IRQ)) {
+		setup_irq_affinity();
+		end_phase(PHASE_IRQ);
+	}
 
-	if (umount("/proc") < 0) {
-		panic("could not unmount /proc: %s (%d)", strerror(errno), errno);
+	// apply USB power policy to present devices and hand it over to udev. the
+	// LAN7500 enumerates while the Ethernet driver thread waits for it, so that
+	// thread is joined here too, independent of the order of the phases
+	if (begin_phase(PHASE_USB)) {
+		finish_ethernet_driver();
+		setup_usb_power();
+		end_phase(PHASE_USB);
 	}
 
-	// unmount /sys
-	print("unmounting /sys");
+	// make all file updates durable at once
+	commit_staged_renames();
 
-	if (umount("/sys") < 0) {
-		panic("could not unmount /sys: %s (%d)", strerror(errno), errno);
+	if (cmdline.ro) {
+		remount_root_read_only();
 	}
 
-	// unmount /dev
-	print("unmounting /dev");
+	restore_performance_profile();
+	report_ethernet_carrier();
 
-	if (umount("/dev") < 0) {
-		panic("could not unmount /dev: %s (%d)", strerror(errno), errno);
+	// open /proc/meminfo before /proc is moved, it might end up unmounted
+	meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+
+	if (meminfo_fd < 0) {
+		error("could not open /proc/meminfo for reading: %s (%d)", strerror(errno), errno);
 	}
 
+	// move /run, /proc, /sys and /dev into the new root, so they don't have to
+	// be mounted again there
+	move_mount_point("/run", NULL);
+	move_mount_point("/proc", NULL);
+	move_mount_point("/sys", NULL);
+	move_mount_point("/dev", "devtmpfs");
+
 	// switch root (logic taken from busybox switch_root and simplified)
 	print("switching root-mount to /mnt");
 
@@ -1193,7 +4609,11 @@ int main(void)
 		panic("could not change current directory to /mnt: %s (%d)", strerror(errno), errno);
 	}
 
-	unlink("/init"); // unlink ourself to free some memory
+	delete_initramfs(meminfo_fd); // includes ourself
+
+	if (meminfo_fd >= 0) {
+		close(meminfo_fd);
+	}
 
 	if (mount(".", "/", NULL, MS_MOVE, NULL) < 0) {
 		panic("could not move root-mount: %s (%d)", strerror(errno), errno);
@@ -1208,7 +4628,7 @@ int main(void)
 	}
 
 	// execute /sbin/init
-	print("executing %s in /mnt", init);
+	print("executing %s in /mnt", cmdline.init);
 
 	if (kmsg_fd >= 0) {
 		close(kmsg_fd);
@@ -1216,11 +4636,11 @@ int main(void)
 		kmsg_fd = -1;
 	}
 
-	execv_argv[0] = init;
+	execv(cmdline.init, (char **)cmdline.init_args);
 
-	execv(execv_argv[0], (char **)execv_argv);
-
-	panic("could not execute %s in /mnt: %s (%d)", init, strerror(errno), errno);
+	panic("could not execute %s in /mnt: %s (%d)", cmdline.init, strerror(errno), errno);
 
 	return EXIT_FAILURE; // unreachable
 }
+
+#endif
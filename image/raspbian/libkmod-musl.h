@@ -0,0 +1,41 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+// included into every libkmod source file when building against musl. kmod 27
+// expects the GNU basename from string.h, which musl 1.2.5 doesn't declare
+// anymore. the POSIX basename from libgen.h might modify its argument, so a
+// GNU compatible one is provided instead
+
+#ifndef LIBKMOD_MUSL_H
+#define LIBKMOD_MUSL_H
+
+#include <libgen.h> // declare the POSIX basename before it's replaced below
+#include <string.h>
+
+static inline char *libkmod_musl_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+
+	return (char *)(slash != NULL ? slash + 1 : path);
+}
+
+#undef basename
+#define basename(path) libkmod_musl_basename(path)
+
+#endif
@@ -31,9 +31,22 @@ rm -rf ${builddir}/
 
 mkdir -p ${builddir}/build/debian/
 
+# only the default variant of make-initramfs.sh is packaged, the other
+# INIT_LIBC and INIT_OPTIMIZE variants are built into their own directories
 cp build-initramfs/initramfs7.img ${builddir}/build/
+cp tng-base-varlog-flush ${builddir}/build/
+cp -r systemd ${builddir}/build/
 cp debian-bootloader/* ${builddir}/build/debian/
 
+# the 64-bit initramfs is optional, it needs an aarch64 cross toolchain and
+# INIT_ARCH=arm64 ./make-initramfs.sh
+if [ -f build-initramfs-arm64/initramfs8.img ]; then
+	cp build-initramfs-arm64/initramfs8.img ${builddir}/build/
+else
+	echo "warning: build-initramfs-arm64/initramfs8.img is missing, packaging without it"
+	sed -i -e '/^initramfs8.img /d' ${builddir}/build/debian/tng-base-rpi-cmx-bootloader.install
+fi
+
 pushd ${builddir}/build/
 
 cat debian/changelog.template | sed -e "s/<<VERSION>>/${version}/g" | sed -e "s/<<DATE>>/$(date -R)/g" > debian/changelog
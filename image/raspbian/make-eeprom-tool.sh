@@ -0,0 +1,33 @@
+#!/bin/bash -ex
+
+#
+# TNG Base Raspberry Pi CMX Image
+# Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+if [ "$(id -u)" -eq "0" ]; then
+	echo "error: must be executed as user"
+	exit 1
+fi
+
+builddir=build-eeprom-tool
+
+rm -rf ${builddir}/
+mkdir -p ${builddir}/
+
+arm-linux-gnueabihf-gcc -s -O2 -Wall -Wextra -Werror -static \
+  -Ibuild-zlib/build tng-eeprom.c eeprom.c build-zlib/build/libz.a -o ${builddir}/tng-eeprom
@@ -24,7 +24,29 @@ if [ "$(id -u)" -eq "0" ]; then
 	exit 1
 fi
 
-builddir=build-initramfs
+. ./build-config.sh
+
+builddir=build-initramfs${suffix}
+
+if [ ${arch} = arm64 ]; then
+	image=initramfs8
+else
+	image=initramfs7
+fi
+
+# gzip, lz4, zstd or none. the kernel needs the matching CONFIG_RD_* option,
+# zstd is only supported since Linux 5.9
+compression=${INITRAMFS_COMPRESSION:-gzip}
+
+case ${compression} in
+gzip) compressor="gzip -9";;
+lz4) compressor="lz4 -l -9";; # the kernel only supports the legacy lz4 format
+zstd) compressor="zstd -19";;
+none) compressor="cat";;
+*)
+	echo "error: unknown compression ${compression}"
+	exit 1;;
+esac
 
 sudo rm -rf ${builddir}/
 
@@ -33,7 +55,7 @@ mkdir -p ${builddir}/build/sys/
 mkdir -p ${builddir}/build/dev/
 mkdir -p ${builddir}/build/etc/
 mkdir -p ${builddir}/build/usr/share/
-mkdir -p ${builddir}/build/run/blkid/
+mkdir -p ${builddir}/build/run/
 mkdir -p ${builddir}/build/mnt/
 
 ln -s /mnt/etc/localtime ${builddir}/build/etc/localtime
@@ -42,11 +64,26 @@ ln -s /mnt/usr/share/zoneinfo ${builddir}/build/usr/share/zoneinfo
 
 sudo mknod -m 644 ${builddir}/build/dev/kmsg c 1 11
 
-arm-linux-gnueabihf-gcc -s -O2 -Wall -Wextra -Werror -static -pthread \
-  -Ibuild-libkmod/build/libkmod -Ibuild-libmount/build -Ibuild-zlib/build init.c \
-  -lcrypt build-libkmod/build/libkmod.a build-libmount/build/libmount.a \
-  build-libmount/build/libblkid.a build-zlib/build/libz.a -lrt -o ${builddir}/build/init
+# link unstripped with a map file for size-report.sh, then strip
+${host}-gcc ${optflags} -Wall -Wextra -Werror -static -pthread \
+  -Ibuild-libkmod${suffix}/build/libkmod -Ibuild-libmount${suffix}/build -Ibuild-zlib${suffix}/build init.c eeprom.c file-batch.c \
+  -lcrypt build-libkmod${suffix}/build/libkmod.a build-libmount${suffix}/build/libmount.a \
+  build-libmount${suffix}/build/libblkid.a build-zlib${suffix}/build/libz.a -lrt ${ldflags} -Wl,-Map=${builddir}/init.map -o ${builddir}/init.unstripped
+
+${host}-strip -o ${builddir}/build/init ${builddir}/init.unstripped
+
+# benchmark for the io_uring and synchronous backend of the initramfs file
+# operations, not part of the initramfs. run it on the device against a
+# directory on the SD card
+${host}-gcc -s ${optflags} -Wall -Wextra -Werror -static \
+  file-batch-bench.c file-batch.c ${ldflags} -o ${builddir}/file-batch-bench
+
+echo "init: ${arch}, ${libc}, ${optimize}, $(stat -c %s ${builddir}/build/init) bytes"
 
 pushd ${builddir}/build/
-find . | cpio -H newc -o | gzip > ../initramfs7.img
+find . | cpio -H newc -o > ../${image}.cpio
 popd
+
+${compressor} < ${builddir}/${image}.cpio > ${builddir}/${image}.img
+
+echo "${image}.img: ${compression}, $(stat -c %s ${builddir}/${image}.img) bytes ($(stat -c %s ${builddir}/${image}.cpio) bytes uncompressed)"
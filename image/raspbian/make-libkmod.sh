@@ -25,7 +25,17 @@ if [ "$(id -u)" -eq "0" ]; then
 fi
 
 version=27
-builddir=build-libkmod
+
+. ./build-config.sh
+
+builddir=build-libkmod${suffix}
+
+# musl has no GNU basename, libkmod-musl.h provides it
+if [ ${libc} = musl ]; then
+	extra_cflags="-include libkmod-musl.h"
+else
+	extra_cflags=""
+fi
 
 rm -rf ${builddir}/
 mkdir -p ${builddir}/
@@ -38,7 +48,7 @@ tar -xf kmod-${version}.tar.gz
 
 pushd kmod-${version}
 ./autogen.sh
-./configure --host=arm-linux-gnueabihf
+./configure --host=${host}
 popd
 
 mkdir -p build/libkmod/
@@ -48,7 +58,8 @@ cp kmod-${version}/libkmod/*.c kmod-${version}/libkmod/*.h build/libkmod/
 cp kmod-${version}/shared/*.c kmod-${version}/shared/*.h build/shared/
 cp kmod-${version}/config.h build/
 cp ../Makefile.libkmod build/Makefile
+cp ../libkmod-musl.h build/
 
 pushd build/
-make
+make CROSS=${host}- OPTFLAGS="${optflags}" EXTRA_CFLAGS="${extra_cflags}"
 popd
@@ -25,7 +25,10 @@ if [ "$(id -u)" -eq "0" ]; then
 fi
 
 version=2.36
-builddir=build-libmount
+
+. ./build-config.sh
+
+builddir=build-libmount${suffix}
 
 rm -rf ${builddir}/
 mkdir -p ${builddir}/
@@ -41,7 +44,8 @@ pushd util-linux-${version}
 patch -p1 < ../../util-linux-${version}.patch
 
 ./autogen.sh
-./configure --host=arm-linux-gnueabihf --without-python
+CFLAGS="${optflags}" AR=${host}-gcc-ar RANLIB=${host}-gcc-ranlib \
+  ./configure --host=${host} --without-python
 
 make mount
 
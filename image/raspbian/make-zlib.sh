@@ -25,7 +25,10 @@ if [ "$(id -u)" -eq "0" ]; then
 fi
 
 version=1.2.11
-builddir=build-zlib
+
+. ./build-config.sh
+
+builddir=build-zlib${suffix}
 
 rm -rf ${builddir}/
 mkdir -p ${builddir}
@@ -38,7 +41,8 @@ tar -xf zlib-${version}.tar.gz
 
 pushd zlib-${version}/
 
-CC=arm-linux-gnueabihf-gcc ./configure --static
+CC=${host}-gcc CFLAGS="${optflags}" AR=${host}-gcc-ar RANLIB=${host}-gcc-ranlib \
+  ./configure --static
 make
 
 popd
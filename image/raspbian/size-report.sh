@@ -0,0 +1,76 @@
+#!/bin/bash -e
+
+#
+# TNG Base Raspberry Pi CMX Image
+# Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# size breakdown of the init binary from the last make-initramfs.sh run, per
+# library (from the linker map file) and per symbol. with INIT_OPTIMIZE=size
+# the code of init.c and the static libraries is merged by LTO and shows up as
+# "lto" instead of per library. the variant is selected as for make-initramfs.sh
+
+. ./build-config.sh
+
+builddir=build-initramfs${suffix}
+nm=${NM:-${host}-nm}
+
+symbol_count=${1:-30}
+
+if [ ! -f ${builddir}/init.map ] || [ ! -f ${builddir}/init.unstripped ]; then
+	echo "error: ${builddir}/init.map or ${builddir}/init.unstripped is missing, run make-initramfs.sh first"
+	exit 1
+fi
+
+echo "size per library:"
+
+# input sections are listed after "Linker script and memory map" as
+# "<section> <address> <size> <file>", long section names wrap the rest
+# into the next line
+awk '
+function hex(s,    i, n) {
+	n = 0
+	s = tolower(substr(s, 3))
+	for (i = 1; i <= length(s); ++i) { n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1 }
+	return n
+}
+/^Linker script and memory map/ { map = 1; next }
+!map { next }
+{
+	if (NF == 1 && $1 ~ /^\./) { section = $1; next }
+	if (NF == 4 && $1 ~ /^\./) { section = $1; address = $2; size = $3; file = $4 }
+	else if (NF == 3 && $1 ~ /^0x/ && section != "") { address = $1; size = $2; file = $3 }
+	else { section = ""; next }
+	section_name = section
+	section = ""
+	if (section_name ~ /^\.(debug|comment|ARM\.attributes|note\.gnu\.gold)/ || hex(address) == 0) { next }
+	if (file ~ /\.a\(/) { sub(/\(.*/, "", file) }
+	if (file ~ /ltrans/) { file = "lto" }
+	sub(/.*\//, "", file)
+	total[file] += hex(size)
+	sum += hex(size)
+}
+END {
+	for (file in total) { if (total[file] > 0) { printf "%10d %s\n", total[file], file } }
+	printf "%10d total\n", sum
+}' ${builddir}/init.map | sort -n -r
+
+echo
+echo "largest ${symbol_count} symbols:"
+
+${nm} --size-sort --reverse-sort --print-size --radix=d ${builddir}/init.unstripped | head -n ${symbol_count} | \
+  awk '{ printf "%10d %s %s\n", $2, $3, $4 }'
@@ -0,0 +1,316 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+// provisioning tool for the TNG EEPROM. uses bulk I2C transfers and the same
+// validation code as init.c. the EEPROM content itself is produced by
+// eeprom.py tng-save
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "eeprom.h"
+
+static uint8_t blob[EEPROM_MAX_LENGTH];
+static uint8_t file_blob[EEPROM_MAX_LENGTH];
+
+static int open_bus(const char *path)
+{
+	int fd = open(path, O_RDWR);
+
+	if (fd < 0) {
+		fprintf(stderr, "error: could not open %s: %s (%d)\n", path, strerror(errno), errno);
+	}
+
+	return fd;
+}
+
+// read and validate the whole EEPROM content, returns its length or 0 on error
+static size_t read_blob(int fd, uint8_t *buffer, EEPROM *eeprom)
+{
+	EEPROM_Header header;
+	char message[256];
+
+	if (eeprom_read(fd, 0, buffer, sizeof(header)) < 0) {
+		fprintf(stderr, "error: could not read EEPROM header: %s (%d)\n", strerror(errno), errno);
+
+		return 0;
+	}
+
+	memcpy(&header, buffer, sizeof(header));
+
+	if (!eeprom_check_header(&header, message, sizeof(message))) {
+		fprintf(stderr, "error: %s\n", message);
+
+		return 0;
+	}
+
+	if (eeprom_read(fd, sizeof(header), buffer + sizeof(header), header.data_length) < 0) {
+		fprintf(stderr, "error: could not read EEPROM data: %s (%d)\n", strerror(errno), errno);
+
+		return 0;
+	}
+
+	if (!eeprom_parse(buffer, sizeof(header) + header.data_length, eeprom, message, sizeof(message))) {
+		fprintf(stderr, "error: %s\n", message);
+
+		return 0;
+	}
+
+	return sizeof(header) + header.data_length;
+}
+
+// load and validate an EEPROM image file, returns its length or 0 on error
+static size_t load_file(const char *path, uint8_t *buffer, EEPROM *eeprom)
+{
+	FILE *fp;
+	size_t length;
+	char message[256];
+
+	fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "error: could not open %s for reading: %s (%d)\n", path, strerror(errno), errno);
+
+		return 0;
+	}
+
+	length = fread(buffer, 1, EEPROM_MAX_LENGTH, fp);
+
+	if (ferror(fp)) {
+		fprintf(stderr, "error: could not read from %s\n", path);
+		fclose(fp);
+
+		return 0;
+	}
+
+	fclose(fp);
+
+	if (!eeprom_parse(buffer, length, eeprom, message, sizeof(message))) {
+		fprintf(stderr, "error: %s: %s\n", path, message);
+
+		return 0;
+	}
+
+	if (length != sizeof(EEPROM_Header) + eeprom->header.data_length) {
+		fprintf(stderr, "error: %s has trailing bytes after EEPROM data\n", path);
+
+		return 0;
+	}
+
+	return length;
+}
+
+static void dump(const EEPROM *eeprom)
+{
+	const uint8_t *ethernet_config = eeprom->data_v1.ethernet_config;
+	const EEPROM_Account *account;
+	int i;
+
+	printf("magic_number:       0x%08X\n", eeprom->header.magic_number);
+	printf("checksum:           0x%08X\n", eeprom->header.checksum);
+	printf("data_length:        %u\n", eeprom->header.data_length);
+	printf("data_version:       %u\n", eeprom->header.data_version);
+	printf("production_date:    %04X-%02X-%02X\n",
+	       eeprom->data_v1.production_date >> 16,
+	       (eeprom->data_v1.production_date >> 8) & 0xFF,
+	       eeprom->data_v1.production_date & 0xFF);
+	printf("uid:                %s\n", eeprom->data_v1.uid);
+	printf("hostname:           %s\n", eeprom->data_v1.hostname);
+	printf("encrypted_password: %s\n", eeprom->data_v1.encrypted_password);
+
+	for (i = 0; eeprom->header.data_version >= 2 && i < EEPROM_ACCOUNT_COUNT; ++i) {
+		account = &eeprom->data_v2.accounts[i];
+
+		if (account->name[0] != '\0') {
+			printf("account %d:          %s %s\n", i, account->name, account->encrypted_password);
+		}
+	}
+
+	if (ethernet_config[0] != 0xA5) {
+		printf("ethernet_config:    not programmed\n");
+	} else {
+		printf("ethernet_config:    MAC address %02X:%02X:%02X:%02X:%02X:%02X\n",
+		       ethernet_config[1], ethernet_config[2], ethernet_config[3],
+		       ethernet_config[4], ethernet_config[5], ethernet_config[6]);
+	}
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [--bus <path>] <action>\n"
+	        "\n"
+	        "actions:\n"
+	        "  dump          read, validate and print EEPROM content\n"
+	        "  dump-cache    print EEPROM content cached by init in %s\n"
+	        "  read <file>   read and validate EEPROM content, store it in <file>\n"
+	        "  write <file>  validate <file>, write it to the EEPROM and verify it\n"
+	        "  verify <file> compare EEPROM content against <file>\n"
+	        "\n"
+	        "default bus is %s\n", name, EEPROM_CACHE_BLOB_PATH, EEPROM_PATH);
+
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+	const char *bus = EEPROM_PATH;
+	const char *action;
+	const char *path = NULL;
+	int i = 1;
+	int fd;
+	EEPROM eeprom;
+	EEPROM file_eeprom;
+	size_t length;
+	size_t file_length;
+	FILE *fp;
+	int rc = EXIT_FAILURE;
+
+	if (argc > 2 && strcmp(argv[1], "--bus") == 0) {
+		bus = argv[2];
+		i = 3;
+	}
+
+	if (i >= argc) {
+		return usage(argv[0]);
+	}
+
+	action = argv[i++];
+
+	if (strcmp(action, "dump") != 0 && strcmp(action, "dump-cache") != 0) {
+		if (i >= argc) {
+			return usage(argv[0]);
+		}
+
+		path = argv[i++];
+	}
+
+	if (i != argc) {
+		return usage(argv[0]);
+	}
+
+	if (strcmp(action, "dump") == 0) {
+		fd = open_bus(bus);
+
+		if (fd < 0) {
+			return EXIT_FAILURE;
+		}
+
+		if (read_blob(fd, blob, &eeprom) > 0) {
+			dump(&eeprom);
+
+			rc = EXIT_SUCCESS;
+		}
+
+		close(fd);
+	} else if (strcmp(action, "dump-cache") == 0) {
+		// no I2C traffic, the cache was validated by init
+		if (load_file(EEPROM_CACHE_BLOB_PATH, blob, &eeprom) > 0) {
+			dump(&eeprom);
+
+			rc = EXIT_SUCCESS;
+		}
+	} else if (strcmp(action, "read") == 0) {
+		fd = open_bus(bus);
+
+		if (fd < 0) {
+			return EXIT_FAILURE;
+		}
+
+		length = read_blob(fd, blob, &eeprom);
+
+		close(fd);
+
+		if (length == 0) {
+			return EXIT_FAILURE;
+		}
+
+		fp = fopen(path, "wb");
+
+		if (fp == NULL) {
+			fprintf(stderr, "error: could not open %s for writing: %s (%d)\n", path, strerror(errno), errno);
+
+			return EXIT_FAILURE;
+		}
+
+		if (fwrite(blob, 1, length, fp) != length) {
+			fprintf(stderr, "error: could not write to %s\n", path);
+		} else {
+			rc = EXIT_SUCCESS;
+		}
+
+		if (fclose(fp) != 0) {
+			fprintf(stderr, "error: could not close %s: %s (%d)\n", path, strerror(errno), errno);
+
+			rc = EXIT_FAILURE;
+		}
+	} else if (strcmp(action, "write") == 0 || strcmp(action, "verify") == 0) {
+		file_length = load_file(path, file_blob, &file_eeprom);
+
+		if (file_length == 0) {
+			return EXIT_FAILURE;
+		}
+
+		fd = open_bus(bus);
+
+		if (fd < 0) {
+			return EXIT_FAILURE;
+		}
+
+		if (strcmp(action, "write") == 0) {
+			printf("writing %zu bytes\n", file_length);
+
+			if (eeprom_write(fd, 0, file_blob, file_length) < 0) {
+				fprintf(stderr, "error: could not write EEPROM: %s (%d)\n", strerror(errno), errno);
+				close(fd);
+
+				return EXIT_FAILURE;
+			}
+		}
+
+		printf("verifying %zu bytes\n", file_length);
+
+		length = read_blob(fd, blob, &eeprom);
+
+		close(fd);
+
+		if (length == 0) {
+			return EXIT_FAILURE;
+		}
+
+		if (length != file_length || memcmp(blob, file_blob, length) != 0) {
+			fprintf(stderr, "error: verification failed\n");
+
+			return EXIT_FAILURE;
+		}
+
+		rc = EXIT_SUCCESS;
+	} else {
+		return usage(argv[0]);
+	}
+
+	return rc;
+}
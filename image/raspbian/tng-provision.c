@@ -0,0 +1,256 @@
+//
+// TNG Base Raspberry Pi CMX Image
+// Copyright (C) 2020 Matthias Bolte <matthias@tinkerforge.com>
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+
+// offline provisioning tool, applies the password and files phases of init.c
+// to root filesystems mounted on the host. the EEPROM image file has to be the
+// one that gets written to the unit, then init finds the password verdicts and
+// the generated files digest up to date and takes the fast path on first boot.
+//
+// init.c is included as is, it expects the root filesystem at /mnt. each root
+// is provisioned in a child process with its own mount namespace that has the
+// root bind mounted at /mnt, so many roots can be provisioned in parallel:
+//
+//   sudo tng-provision --root-prefix /media/unit1 --eeprom unit1.bin
+//                      --root-prefix /media/unit2 --eeprom unit2.bin
+
+#define TNG_PROVISION
+
+#include "init.c"
+
+#include <sched.h>
+#include <sys/wait.h>
+
+#define ROOT_COUNT 256
+#define ROOT_DEVICE_MAJOR 179 // mmcblk0p2, the root on the unit
+#define ROOT_DEVICE_MINOR 2
+
+typedef struct {
+	const char *root_prefix;
+	const char *eeprom_path;
+	pid_t pid;
+} Root;
+
+static Root roots[ROOT_COUNT];
+static size_t root_count = 0;
+
+// load and validate an EEPROM image file into the globals read_eeprom fills
+static void load_eeprom(const char *path)
+{
+	FILE *fp;
+	size_t length;
+	char message[256];
+
+	eeprom_valid = false;
+
+	fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		panic("could not open %s for reading: %s (%d)", path, strerror(errno), errno);
+	}
+
+	length = fread(eeprom_blob, 1, sizeof(eeprom_blob), fp);
+
+	if (ferror(fp)) {
+		panic("could not read from %s", path);
+	}
+
+	fclose(fp);
+
+	if (!eeprom_parse(eeprom_blob, length, &eeprom, message, sizeof(message))) {
+		panic("%s: %s", path, message);
+	}
+
+	if (length != sizeof(EEPROM_Header) + eeprom.header.data_length) {
+		panic("%s has trailing bytes after EEPROM data", path);
+	}
+
+	eeprom_valid = true;
+	eeprom_blob_length = length;
+}
+
+// runs in the child process, panic exits it with EXIT_FAILURE
+static void provision(const Root *root)
+{
+	log_name = root->root_prefix;
+
+	setvbuf(stdout, NULL, _IOLBF, 0); // keep lines of parallel children intact
+
+	load_eeprom(root->eeprom_path);
+
+	if (unshare(CLONE_NEWNS) < 0) {
+		panic("could not create mount namespace: %s (%d)", strerror(errno), errno);
+	}
+
+	// don't propagate the bind mount back to the host
+	if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0) {
+		panic("could not make / private: %s (%d)", strerror(errno), errno);
+	}
+
+	if (mount(root->root_prefix, "/mnt", NULL, MS_BIND | MS_REC, NULL) < 0) {
+		panic("could not bind mount %s at /mnt: %s (%d)", root->root_prefix, strerror(errno), errno);
+	}
+
+	file_batch_init(&file_batch, false);
+
+	replace_password();
+	generate_files();
+	commit_staged_renames();
+
+	file_batch_free(&file_batch);
+}
+
+static int usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [--jobs <count>] [--root-device <major>:<minor>] [--force] [--quiet]\n"
+	        "       %*s --root-prefix <path> --eeprom <file> [--root-prefix <path> --eeprom <file> ...]\n"
+	        "\n"
+	        "  --jobs         number of roots provisioned in parallel, default is the number of CPUs\n"
+	        "  --root-device  device the root is mounted from on the unit, default is %d:%d\n"
+	        "  --force        ignore password verdicts and generated files digest (like tng.force)\n"
+	        "  --quiet        only log errors\n"
+	        "  --root-prefix  mounted root filesystem of a unit\n"
+	        "  --eeprom       EEPROM image file of that unit, as produced by eeprom.py tng-save\n",
+	        name, (int)strlen(name), "", ROOT_DEVICE_MAJOR, ROOT_DEVICE_MINOR);
+
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int major = ROOT_DEVICE_MAJOR;
+	unsigned int minor = ROOT_DEVICE_MINOR;
+	char *end;
+	int i;
+	size_t next = 0;
+	size_t running = 0;
+	size_t failed = 0;
+	size_t k;
+	pid_t pid;
+	int status;
+	uint64_t start = milliseconds();
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--force") == 0) {
+			cmdline.force = true;
+		} else if (strcmp(argv[i], "--quiet") == 0) {
+			cmdline.log_level = LOG_LEVEL_ERROR;
+		} else if (i + 1 >= argc) {
+			return usage(argv[0]);
+		} else if (strcmp(argv[i], "--jobs") == 0) {
+			jobs = strtol(argv[++i], &end, 10);
+
+			if (*end != '\0' || jobs < 1) {
+				return usage(argv[0]);
+			}
+		} else if (strcmp(argv[i], "--root-device") == 0) {
+			if (sscanf(argv[++i], "%u:%u", &major, &minor) != 2) {
+				return usage(argv[0]);
+			}
+		} else if (strcmp(argv[i], "--root-prefix") == 0) {
+			if (root_count > 0 && roots[root_count - 1].eeprom_path == NULL) {
+				return usage(argv[0]);
+			}
+
+			if (root_count >= ROOT_COUNT) {
+				fprintf(stderr, "error: more than %d roots\n", ROOT_COUNT);
+
+				return EXIT_FAILURE;
+			}
+
+			roots[root_count++].root_prefix = argv[++i];
+		} else if (strcmp(argv[i], "--eeprom") == 0) {
+			if (root_count == 0 || roots[root_count - 1].eeprom_path != NULL) {
+				return usage(argv[0]);
+			}
+
+			roots[root_count - 1].eeprom_path = argv[++i];
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	if (root_count == 0 || roots[root_count - 1].eeprom_path == NULL) {
+		return usage(argv[0]);
+	}
+
+	if (geteuid() != 0) {
+		fprintf(stderr, "error: must be executed as root\n");
+
+		return EXIT_FAILURE;
+	}
+
+	// the password verdicts are keyed by the identity of /etc/shadow. the
+	// inode and the mtime survive copying the image, the device number has
+	// to be the one init will see
+	password_verdict_device = makedev(major, minor);
+
+	fflush(stdout); // don't duplicate buffered output into the children
+
+	while (next < root_count || running > 0) {
+		if (next < root_count && running < (size_t)jobs) {
+			pid = fork();
+
+			if (pid < 0) {
+				fprintf(stderr, "error: could not fork: %s (%d)\n", strerror(errno), errno);
+
+				return EXIT_FAILURE;
+			}
+
+			if (pid == 0) {
+				provision(&roots[next]);
+
+				exit(EXIT_SUCCESS);
+			}
+
+			roots[next++].pid = pid;
+			++running;
+
+			continue;
+		}
+
+		pid = wait(&status);
+
+		if (pid < 0) {
+			fprintf(stderr, "error: could not wait for child: %s (%d)\n", strerror(errno), errno);
+
+			return EXIT_FAILURE;
+		}
+
+		--running;
+
+		for (k = 0; k < next; ++k) {
+			if (roots[k].pid == pid) {
+				break;
+			}
+		}
+
+		if (k < next && (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			fprintf(stderr, "error: could not provision %s\n", roots[k].root_prefix);
+
+			++failed;
+		}
+	}
+
+	printf("provisioned %zu of %zu roots in %llu msec\n",
+	       root_count - failed, root_count, (unsigned long long)(milliseconds() - start));
+
+	return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}